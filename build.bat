@@ -4,10 +4,10 @@ cls
 md build
 
 echo Compiling "pallet-gen.cpp"...
-g++ -Wall -o pallet-gen pallet-gen.cpp lib/pallet.cpp lib/colors.cpp lib/mosaic.cpp -I.
+g++ -Wall -o pallet-gen pallet-gen.cpp lib/pallet.cpp lib/colors.cpp lib/mosaic.cpp lib/imagereader.cpp lib/renderer.cpp lib/parallel.cpp lib/deflate.cpp lib/pngwriter.cpp lib/imagewriter.cpp lib/mappedfile.cpp lib/tilecache.cpp lib/tilestore.cpp lib/matcher.cpp lib/assigner.cpp lib/dither.cpp lib/labplanes.cpp lib/pipeline.cpp lib/quadtree.cpp lib/frames.cpp lib/incremental.cpp lib/shards.cpp -I. -pthread
 
 echo Compiling "main.cpp"...
-g++ -Wall -o terramosaic main.cpp lib/pallet.cpp ./lib/colors.cpp ./lib/mosaic.cpp  -I.
+g++ -Wall -o terramosaic main.cpp lib/pallet.cpp ./lib/colors.cpp ./lib/mosaic.cpp ./lib/imagereader.cpp ./lib/renderer.cpp ./lib/parallel.cpp ./lib/deflate.cpp ./lib/pngwriter.cpp ./lib/imagewriter.cpp ./lib/mappedfile.cpp ./lib/tilecache.cpp ./lib/tilestore.cpp ./lib/matcher.cpp ./lib/assigner.cpp ./lib/dither.cpp ./lib/labplanes.cpp ./lib/pipeline.cpp ./lib/quadtree.cpp ./lib/frames.cpp ./lib/incremental.cpp ./lib/shards.cpp -I. -pthread
 
 move pallet-gen.exe ./build
 move terramosaic.exe ./build
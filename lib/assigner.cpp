@@ -0,0 +1,187 @@
+#include "assigner.h"
+#include <atomic>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include "matcher.h"
+#include "parallel.h"
+
+unsigned int TileAssigner::maxUses = 0;
+double TileAssigner::minRepeatDistance = 0;
+unsigned int TileAssigner::candidateCount = 16;
+
+bool TileAssigner::enabled(){
+    return maxUses > 0 || minRepeatDistance > 0;
+}
+
+struct AssignmentState{
+    const LabPlanes &pixels;
+    const vector<palletTile> &palletTiles;
+    unsigned int gridWidth;
+    unsigned int gridHeight;
+    int repeatRadius;
+
+    vector<Tile> candidates;
+    vector<Tile> tiles;
+    vector<int> assigned;
+    vector<atomic<uint32_t>> uses;
+    TileMatcher *matcher;
+    atomic<uint64_t> fallbacks;
+    atomic<uint64_t> relaxed;
+
+    AssignmentState(const LabPlanes &pixels, const vector<palletTile> &palletTiles) : pixels(pixels), palletTiles(palletTiles), uses(palletTiles.size()){
+        fallbacks = 0;
+        relaxed = 0;
+        matcher = nullptr;
+    }
+};
+
+// Checks the repeat distance and claims one use of the tile if it's allowed
+static bool claimTile(AssignmentState &state, uint64_t cell, int palletId){
+    if (palletId < 0) return true;
+
+    if (state.repeatRadius > 0){
+        const int64_t x = cell % state.gridWidth;
+        const int64_t y = cell / state.gridWidth;
+        const double minDistance2 = TileAssigner::minRepeatDistance * TileAssigner::minRepeatDistance;
+
+        for (int64_t ny = max((int64_t)0, y - state.repeatRadius); ny <= min((int64_t)state.gridHeight - 1, y + state.repeatRadius); ny++){
+            for (int64_t nx = max((int64_t)0, x - state.repeatRadius); nx <= min((int64_t)state.gridWidth - 1, x + state.repeatRadius); nx++){
+                if (state.assigned[ny * state.gridWidth + nx] != palletId) continue;
+                if ((double)((nx - x) * (nx - x) + (ny - y) * (ny - y)) < minDistance2) return false;
+            }
+        }
+    }
+
+    if (TileAssigner::maxUses > 0){
+        if (state.uses[palletId].fetch_add(1) >= TileAssigner::maxUses) {
+            state.uses[palletId]--;
+            return false;
+        }
+    }
+    else state.uses[palletId]++;
+
+    return true;
+}
+
+static void assignCell(AssignmentState &state, uint64_t cell, const Tile &tile){
+    state.assigned[cell] = tile.palletId;
+    state.tiles[cell] = tile;
+    state.tiles[cell].pixelId = cell;
+}
+
+// The candidates ran out, so the closest tile the limits still allow is searched for 
+// through the matcher's index. Tiles that used up "maxUses" never come back so the 
+// index skips them, and twice as many tiles are asked for every time the repeat 
+// distance turns all of them down
+static void assignFallback(AssignmentState &state, uint64_t cell){
+    state.fallbacks++;
+
+    const CIELABColor pixel = state.pixels.get(cell);
+    const uint64_t palletSize = state.palletTiles.size();
+    auto usable = [&](int palletId){ return TileAssigner::maxUses < 1 || state.uses[palletId] < TileAssigner::maxUses; };
+
+    vector<Tile> ranked;
+    for (uint64_t count = (uint64_t)TileAssigner::candidateCount * 2; ; count *= 2){
+        count = min(count, palletSize);
+        state.matcher->matchNearest(pixel, count, ranked, usable);
+
+        for (uint64_t i = 0; i < ranked.size(); i++){
+            if (claimTile(state, cell, ranked[i].palletId)) {
+                assignCell(state, cell, ranked[i]);
+                return;
+            }
+        }
+
+        // Fewer tiles than asked for means every usable tile was turned down
+        if (count >= palletSize || ranked.size() < count) break;
+    }
+    state.matcher->matchNearest(pixel, 1, ranked);
+
+    // No tile satisfies the limits, so the closest one is used anyway
+    state.relaxed++;
+    state.uses[ranked[0].palletId]++;
+    assignCell(state, cell, ranked[0]);
+}
+
+static void assignStrip(AssignmentState &state, unsigned int rowStart, unsigned int rowEnd){
+    const unsigned int k = TileAssigner::candidateCount;
+
+    // Ordered by the candidate's deltaE, then by cell so the order is always the same
+    typedef pair<double, pair<uint64_t, unsigned int>> Claim;
+    priority_queue<Claim, vector<Claim>, greater<Claim>> claims;
+
+    for (uint64_t cell = (uint64_t)rowStart * state.gridWidth; cell < (uint64_t)rowEnd * state.gridWidth; cell++){
+        const Tile &closest = state.candidates[cell * k];
+        if (closest.palletId < 0) assignCell(state, cell, closest);
+        else claims.push({closest.closestDeltaE, {cell, 0}});
+    }
+
+    while (!claims.empty()){
+        uint64_t cell = claims.top().second.first;
+        unsigned int rank = claims.top().second.second;
+        claims.pop();
+
+        const Tile &candidate = state.candidates[cell * k + rank];
+        if (claimTile(state, cell, candidate.palletId)) {
+            assignCell(state, cell, candidate);
+            continue;
+        }
+
+        if (rank + 1 < k && state.candidates[cell * k + rank + 1].palletId >= 0) {
+            claims.push({state.candidates[cell * k + rank + 1].closestDeltaE, {cell, rank + 1}});
+        }
+        else assignFallback(state, cell);
+    }
+}
+
+vector<Tile> TileAssigner::assign(const LabPlanes &pixels, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode){
+    const unsigned int k = max(1u, candidateCount);
+    candidateCount = k;
+
+    AssignmentState state(pixels, palletTiles);
+    state.gridWidth = gridWidth;
+    state.gridHeight = gridHeight;
+    state.repeatRadius = (minRepeatDistance > 0) ? (int)ceil(minRepeatDistance) - 1 : 0;
+    state.candidates.resize(pixels.size() * k);
+    state.tiles.resize(pixels.size());
+    state.assigned.assign(pixels.size(), -1);
+
+    // Closest candidates of every cell, transparent cells only get the transparent tile
+    TileMatcher matcher(palletTiles, true);
+    state.matcher = &matcher;
+    Parallel::forEach(gridHeight, threadCount, [&](uint64_t row){
+        vector<Tile> nearest;
+        for (uint64_t cell = row * gridWidth; cell < (row + 1) * gridWidth; cell++){
+            Tile *cellCandidates = &state.candidates[cell * k];
+            for (unsigned int i = 0; i < k; i++) cellCandidates[i].palletId = -1;
+
+            if (pixels.isTransparent(cell)) continue;
+
+            matcher.matchNearest(pixels.get(cell), k, nearest);
+            for (uint64_t i = 0; i < nearest.size(); i++) cellCandidates[i] = nearest[i];
+        }
+    });
+    if (!silentMode) cout << "Found the " << k << " closest tiles for " << pixels.size() << " cells\n";
+
+    // Strips have to be at least as tall as the repeat radius so that 
+    // strips with one strip between them never see each other's cells
+    const unsigned int stripHeight = max(32u, (unsigned int)state.repeatRadius + 1);
+    const unsigned int stripCount = (gridHeight + stripHeight - 1) / stripHeight;
+
+    for (unsigned int phase = 0; phase < 2; phase++){
+        Parallel::forEach((stripCount + 1 - phase) / 2, threadCount, [&](uint64_t i){
+            unsigned int strip = i * 2 + phase;
+            assignStrip(state, strip * stripHeight, min(gridHeight, (strip + 1) * stripHeight));
+        });
+    }
+
+    if (!silentMode) cout << "Assigned tiles under the repetition limits, " << state.fallbacks 
+        << " cells searched past their closest tiles\n";
+    if (state.relaxed > 0) cout << "Warning: " << state.relaxed << " cells couldn't satisfy the repetition limits and use their closest tile\n";
+
+    // The limits count uses of the matched tiles, their variants are picked afterwards
+    for (Tile &tile : state.tiles) tile.palletId = Pallet::pickVariant(palletTiles, tile.palletId, tile.pixelId);
+
+    return state.tiles;
+}
@@ -0,0 +1,37 @@
+#ifndef ASSIGNER_H
+#define ASSIGNER_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include "tile.h"
+#include "colors.h"
+#include "pallet.h"
+#include "labplanes.h"
+
+using namespace std;
+
+// Assigns pallet tiles to the grid under repetition limits. Every cell 
+// gets its "candidateCount" closest tiles and cells claim tiles greedily, 
+// the cell with the closest remaining candidate first, skipping tiles 
+// the limits don't allow anymore. The grid is split into strips that 
+// are solved in parallel, first the even ones and then the odd ones, 
+// so strips being solved at the same time are always more than 
+// "minRepeatDistance" apart
+class TileAssigner{
+    public:
+        // Most cells a single pallet tile can be used for, 0 for no limit
+        static unsigned int maxUses;
+
+        // Cells closer than this (in cells) can't use the same pallet tile, 0 for no limit
+        static double minRepeatDistance;
+
+        // Closest tiles considered for every cell before falling back to searching further out
+        static unsigned int candidateCount;
+
+        static bool enabled();
+
+        static vector<Tile> assign(const LabPlanes &pixels, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode);
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "colors.h"
+#include <algorithm>
 
 // RGBColor
 void RGBColor::setValues(int r, int g, int b, int a){
@@ -89,14 +90,20 @@ RGBColor Colors::calcAvrgImgRGBColor(vector<RGBColor> colors, int width, int hei
 }
 
 CIELABColor Colors::rgbToCIELAB(RGBColor rgbColor){
-    double R = (float)rgbColor.r / (float)255.0;
-    double G = (float)rgbColor.g / (float)255.0;
-    double B = (float)rgbColor.b / (float)255.0;
+    double R = srgbToLinear(rgbColor.r);
+    double G = srgbToLinear(rgbColor.g);
+    double B = srgbToLinear(rgbColor.b);
 
-    R = (R > 0.04045) ? pow((R + 0.055) / 1.055, 2.4) : R / 12.92;
-    G = (G > 0.04045) ? pow((G + 0.055) / 1.055, 2.4) : G / 12.92;
-    B = (B > 0.04045) ? pow((B + 0.055) / 1.055, 2.4) : B / 12.92;
+    return linearRGBToCIELAB(R, G, B, (rgbColor.a == 0) ? true : false);
+} 
+
+double Colors::srgbToLinear(int channel){
+    double C = (float)channel / (float)255.0;
 
+    return (C > 0.04045) ? pow((C + 0.055) / 1.055, 2.4) : C / 12.92;
+}
+
+CIELABColor Colors::linearRGBToCIELAB(double R, double G, double B, bool transparent){
     R *= 100.0;
     G *= 100.0;
     B *= 100.0;
@@ -115,8 +122,8 @@ CIELABColor Colors::rgbToCIELAB(RGBColor rgbColor){
     Y = (Y > 0.008856) ? pow(Y, 1.0 / 3.0) : (903.3 * Y + 16.0) / 116.0;
     Z = (Z > 0.008856) ? pow(Z, 1.0 / 3.0) : (903.3 * Z + 16.0) / 116.0;
 
-    return CIELABColor((0.0, 116.0 * Y - 16.0), (X - Y) * 500.0, (Y - Z) * 200.0, (rgbColor.a == 0) ? true : false);
-} 
+    return CIELABColor((0.0, 116.0 * Y - 16.0), (X - Y) * 500.0, (Y - Z) * 200.0, transparent);
+}
 
 double Colors::calcDeltaE(CIELABColor labColor1, CIELABColor labColor2){
 	double deltaL = labColor2.L - labColor1.L;
@@ -125,4 +132,101 @@ double Colors::calcDeltaE(CIELABColor labColor1, CIELABColor labColor2){
 
 	double deltaE = sqrt(deltaL * deltaL + deltaA * deltaA + deltaB * deltaB);
 	return deltaE;
-}
\ No newline at end of file
+}
+
+double Colors::calcDeltaE94(const CIELABColor &labColor1, const CIELABColor &labColor2){
+	double deltaL = labColor1.L - labColor2.L;
+	double C1 = sqrt(labColor1.a * labColor1.a + labColor1.b * labColor1.b);
+	double C2 = sqrt(labColor2.a * labColor2.a + labColor2.b * labColor2.b);
+	double deltaC = C1 - C2;
+	double deltaA = labColor1.a - labColor2.a;
+	double deltaB = labColor1.b - labColor2.b;
+
+	// Rounding can push the hue difference slightly below 0
+	double deltaH2 = max(0.0, deltaA * deltaA + deltaB * deltaB - deltaC * deltaC);
+
+	double SC = 1.0 + 0.045 * C1;
+	double SH = 1.0 + 0.015 * C1;
+
+	return sqrt(deltaL * deltaL + (deltaC * deltaC) / (SC * SC) + deltaH2 / (SH * SH));
+}
+
+double Colors::calcDeltaE2000(const CIELABColor &labColor1, const CIELABColor &labColor2){
+	const double pi = 3.14159265358979323846;
+	const double pow25_7 = 6103515625.0; // 25^7
+
+	double C1 = sqrt(labColor1.a * labColor1.a + labColor1.b * labColor1.b);
+	double C2 = sqrt(labColor2.a * labColor2.a + labColor2.b * labColor2.b);
+	double meanC7 = pow((C1 + C2) / 2.0, 7.0);
+	double G = 0.5 * (1.0 - sqrt(meanC7 / (meanC7 + pow25_7)));
+
+	// a* is stretched so neutral colors get their hues apart
+	double a1 = (1.0 + G) * labColor1.a;
+	double a2 = (1.0 + G) * labColor2.a;
+	double C1p = sqrt(a1 * a1 + labColor1.b * labColor1.b);
+	double C2p = sqrt(a2 * a2 + labColor2.b * labColor2.b);
+
+	double h1p = (C1p == 0) ? 0 : atan2(labColor1.b, a1) * 180.0 / pi;
+	double h2p = (C2p == 0) ? 0 : atan2(labColor2.b, a2) * 180.0 / pi;
+	if (h1p < 0) h1p += 360.0;
+	if (h2p < 0) h2p += 360.0;
+
+	double deltaLp = labColor2.L - labColor1.L;
+	double deltaCp = C2p - C1p;
+
+	double deltahp = 0;
+	if (C1p * C2p != 0){
+		deltahp = h2p - h1p;
+		if (deltahp > 180.0) deltahp -= 360.0;
+		else if (deltahp < -180.0) deltahp += 360.0;
+	}
+	double deltaHp = 2.0 * sqrt(C1p * C2p) * sin(deltahp * pi / 360.0);
+
+	double meanLp = (labColor1.L + labColor2.L) / 2.0;
+	double meanCp = (C1p + C2p) / 2.0;
+
+	double meanhp = h1p + h2p;
+	if (C1p * C2p != 0){
+		if (fabs(h1p - h2p) <= 180.0) meanhp /= 2.0;
+		else if (h1p + h2p < 360.0) meanhp = (meanhp + 360.0) / 2.0;
+		else meanhp = (meanhp - 360.0) / 2.0;
+	}
+
+	double T = 1.0 
+		- 0.17 * cos((meanhp - 30.0) * pi / 180.0)
+		+ 0.24 * cos((2.0 * meanhp) * pi / 180.0)
+		+ 0.32 * cos((3.0 * meanhp + 6.0) * pi / 180.0)
+		- 0.20 * cos((4.0 * meanhp - 63.0) * pi / 180.0);
+
+	double deltaTheta = 30.0 * exp(-((meanhp - 275.0) / 25.0) * ((meanhp - 275.0) / 25.0));
+	double meanCp7 = pow(meanCp, 7.0);
+	double RC = 2.0 * sqrt(meanCp7 / (meanCp7 + pow25_7));
+
+	double SL = 1.0 + (0.015 * (meanLp - 50.0) * (meanLp - 50.0)) / sqrt(20.0 + (meanLp - 50.0) * (meanLp - 50.0));
+	double SC = 1.0 + 0.045 * meanCp;
+	double SH = 1.0 + 0.015 * meanCp * T;
+	double RT = -sin(2.0 * deltaTheta * pi / 180.0) * RC;
+
+	double L = deltaLp / SL;
+	double C = deltaCp / SC;
+	double H = deltaHp / SH;
+
+	return sqrt(max(0.0, L * L + C * C + H * H + RT * C * H));
+}
+
+double Colors::calcDeltaE(const CIELABColor &labColor1, const CIELABColor &labColor2, DeltaEMetric metric){
+	switch (metric){
+		case DELTAE_CIE94: return calcDeltaE94(labColor1, labColor2);
+		case DELTAE_CIEDE2000: return calcDeltaE2000(labColor1, labColor2);
+		default: return calcDeltaE(labColor1, labColor2);
+	}
+}
+
+bool Colors::parseDeltaEMetric(string name, DeltaEMetric *metric){
+	if (name == "cie76") *metric = DELTAE_CIE76;
+	else if (name == "cie94") *metric = DELTAE_CIE94;
+	else if (name == "ciede2000") *metric = DELTAE_CIEDE2000;
+	else return 1;
+
+	return 0;
+}
@@ -44,13 +44,34 @@ class CIELABColor{
 	CIELABColor(double L, double a, double b, bool transparent);
 };
 
+// Color difference formulas the matcher can rank pallet tiles by
+enum DeltaEMetric{
+	DELTAE_CIE76,
+	DELTAE_CIE94,
+	DELTAE_CIEDE2000
+};
+
 class Colors{
 	public:
 		static RGBColor calcAvrgImgRGBColor(vector<RGBColor> colors, int width, int height);
 
 		static CIELABColor rgbToCIELAB(RGBColor rgbColor);
 
+		static double srgbToLinear(int channel);
+
+		static CIELABColor linearRGBToCIELAB(double R, double G, double B, bool transparent);
+
 		static double calcDeltaE(CIELABColor labColor1, CIELABColor labColor2);
+
+		// CIE94 with the graphic arts weights, "labColor1" is the reference color
+		static double calcDeltaE94(const CIELABColor &labColor1, const CIELABColor &labColor2);
+
+		static double calcDeltaE2000(const CIELABColor &labColor1, const CIELABColor &labColor2);
+
+		static double calcDeltaE(const CIELABColor &labColor1, const CIELABColor &labColor2, DeltaEMetric metric);
+
+		// Parses "cie76", "cie94" or "ciede2000", returns "true" on error
+		static bool parseDeltaEMetric(string name, DeltaEMetric *metric);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include "deflate.h"
+
+namespace {
+    const unsigned int WINDOW_SIZE = 32768;
+    const unsigned int HASH_BITS = 15;
+    const unsigned int MIN_MATCH = 3;
+    const unsigned int MAX_MATCH = 258;
+
+    const unsigned int lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const unsigned int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const unsigned int distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    const unsigned int distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    // Deflate is written least significant bit first
+    struct BitWriter{
+        vector<uint8_t> &out;
+        uint64_t buffer = 0;
+        int count = 0;
+
+        BitWriter(vector<uint8_t> &out) : out(out){}
+
+        void put(uint32_t bits, int length){
+            buffer |= (uint64_t)bits << count;
+            count += length;
+            while (count >= 8){
+                out.push_back(buffer & 0xFF);
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes are stored most significant bit first
+        void putCode(uint32_t code, int length){
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+            put(reversed, length);
+        }
+
+        void putSymbol(unsigned int symbol){
+            if (symbol <= 143) putCode(0x30 + symbol, 8);
+            else if (symbol <= 255) putCode(0x190 + symbol - 144, 9);
+            else if (symbol <= 279) putCode(symbol - 256, 7);
+            else putCode(0xC0 + symbol - 280, 8);
+        }
+
+        void align(){
+            if (count > 0) out.push_back(buffer & 0xFF);
+            buffer = 0;
+            count = 0;
+        }
+    };
+
+    struct CodeTables{
+        uint8_t lengthCode[MAX_MATCH + 1];
+        uint8_t distanceCode[WINDOW_SIZE + 1];
+        uint32_t crc[256];
+
+        CodeTables(){
+            for (unsigned int code = 0; code < 29; code++){
+                unsigned int end = (code < 28) ? lengthBase[code + 1] : MAX_MATCH + 1;
+                for (unsigned int length = lengthBase[code]; length < end; length++) lengthCode[length] = code;
+            }
+
+            for (unsigned int code = 0; code < 30; code++){
+                unsigned int end = (code < 29) ? distanceBase[code + 1] : WINDOW_SIZE + 1;
+                for (unsigned int distance = distanceBase[code]; distance < end; distance++) distanceCode[distance] = code;
+            }
+
+            for (uint32_t i = 0; i < 256; i++){
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                crc[i] = c;
+            }
+        }
+    };
+
+    const CodeTables& codeTables(){
+        static const CodeTables tables;
+        return tables;
+    }
+}
+
+void Deflate::compress(const uint8_t *data, uint64_t size, int level, bool last, vector<uint8_t> &out){
+    BitWriter bits(out);
+
+    if (level <= 0){
+        // Stored blocks are byte aligned already so pieces 
+        // can be joined without an extra empty block
+        uint64_t pos = 0;
+        do {
+            uint32_t length = (size - pos > 65535) ? 65535 : size - pos;
+            bool finalBlock = last && pos + length >= size;
+
+            bits.put(finalBlock ? 1 : 0, 1);
+            bits.put(0, 2);
+            bits.align();
+            out.push_back(length & 0xFF);
+            out.push_back(length >> 8);
+            out.push_back(~length & 0xFF);
+            out.push_back((~length >> 8) & 0xFF);
+            out.insert(out.end(), data + pos, data + pos + length);
+
+            pos += length;
+        } while (pos < size);
+
+        return;
+    }
+
+    if (level > 9) level = 9;
+    const unsigned int maxChainLengths[10] = {0, 2, 4, 8, 16, 32, 64, 128, 256, 1024};
+    const unsigned int niceLengths[10] = {0, 16, 32, 32, 64, 128, 128, 258, 258, 258};
+    const unsigned int maxChainLength = maxChainLengths[level];
+    const unsigned int niceLength = niceLengths[level];
+    const CodeTables &tables = codeTables();
+
+    // Hash chains over the last "WINDOW_SIZE" positions
+    vector<int64_t> head;
+    vector<int64_t> prev;
+    head.resize(1 << HASH_BITS, -1);
+    prev.resize(WINDOW_SIZE, -1);
+
+    auto hash = [&](uint64_t pos){
+        uint32_t value = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    };
+    auto insert = [&](uint64_t pos){
+        uint32_t h = hash(pos);
+        prev[pos % WINDOW_SIZE] = head[h];
+        head[h] = pos;
+    };
+
+    bits.put(last ? 1 : 0, 1);
+    bits.put(1, 2); // fixed Huffman codes
+
+    uint64_t pos = 0;
+    while (pos < size){
+        unsigned int bestLength = 0;
+        unsigned int bestDistance = 0;
+
+        if (pos + MIN_MATCH <= size){
+            const unsigned int maxLength = (size - pos < MAX_MATCH) ? size - pos : MAX_MATCH;
+
+            int64_t candidate = head[hash(pos)];
+            unsigned int chain = maxChainLength;
+            while (candidate >= 0 && pos - candidate <= WINDOW_SIZE && chain-- > 0){
+                const uint8_t *a = data + candidate;
+                const uint8_t *b = data + pos;
+                if (a[bestLength] == b[bestLength]){
+                    unsigned int length = 0;
+                    while (length < maxLength && a[length] == b[length]) length++;
+
+                    if (length > bestLength){
+                        bestLength = length;
+                        bestDistance = pos - candidate;
+                        if (length >= niceLength || length >= maxLength) break;
+                    }
+                }
+                candidate = prev[candidate % WINDOW_SIZE];
+            }
+
+            insert(pos);
+        }
+
+        if (bestLength >= MIN_MATCH){
+            unsigned int lengthCode = tables.lengthCode[bestLength];
+            bits.putSymbol(257 + lengthCode);
+            bits.put(bestLength - lengthBase[lengthCode], lengthExtra[lengthCode]);
+
+            unsigned int distanceCode = tables.distanceCode[bestDistance];
+            bits.putCode(distanceCode, 5);
+            bits.put(bestDistance - distanceBase[distanceCode], distanceExtra[distanceCode]);
+
+            // The fastest levels don't index the inside of matches
+            if (level >= 4){
+                for (uint64_t i = pos + 1; i < pos + bestLength && i + MIN_MATCH <= size; i++) insert(i);
+            }
+            pos += bestLength;
+        }
+        else {
+            bits.putSymbol(data[pos]);
+            pos++;
+        }
+    }
+
+    bits.putSymbol(256); // end of block
+
+    if (last) {
+        bits.align();
+        return;
+    }
+
+    // Empty stored block so the next piece starts on a byte boundary
+    bits.put(0, 1);
+    bits.put(0, 2);
+    bits.align();
+    out.push_back(0x00);
+    out.push_back(0x00);
+    out.push_back(0xFF);
+    out.push_back(0xFF);
+}
+
+uint32_t Deflate::adler32(const uint8_t *data, uint64_t size, uint32_t adler){
+    const uint32_t BASE = 65521;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    // 5552 is the most bytes that can be summed before "b" could overflow
+    while (size > 0){
+        uint64_t block = (size < 5552) ? size : 5552;
+        size -= block;
+        while (block-- > 0){
+            a += *data++;
+            b += a;
+        }
+        a %= BASE;
+        b %= BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+uint32_t Deflate::adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2){
+    const uint64_t BASE = 65521;
+    uint64_t remainder = size2 % BASE;
+    uint64_t sum1 = adler1 & 0xFFFF;
+    uint64_t sum2 = (remainder * sum1) % BASE;
+
+    sum1 += (adler2 & 0xFFFF) + BASE - 1;
+    sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + BASE - remainder;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+    if (sum2 >= BASE) sum2 -= BASE;
+
+    return (uint32_t)(sum1 | (sum2 << 16));
+}
+
+uint32_t Deflate::crc32(const uint8_t *data, uint64_t size, uint32_t crc){
+    const uint32_t *table = codeTables().crc;
+
+    crc = ~crc;
+    for (uint64_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
@@ -0,0 +1,29 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#pragma once
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Minimal raw deflate (RFC 1951) encoder using the fixed Huffman codes.
+// Every call compresses an independent piece of data and, unless it's the 
+// last one, ends it on a byte boundary with an empty stored block. Pieces 
+// compressed on different threads can then be concatenated as is into 
+// one deflate stream the same way pigz does it
+class Deflate{
+    public:
+        // Level 0 only stores the data, 1 is the fastest 
+        // compression and 9 searches the longest for matches
+        static void compress(const uint8_t *data, uint64_t size, int level, bool last, vector<uint8_t> &out);
+
+        static uint32_t adler32(const uint8_t *data, uint64_t size, uint32_t adler = 1);
+
+        // Adler-32 of two concatenated pieces from their own checksums
+        static uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2);
+
+        static uint32_t crc32(const uint8_t *data, uint64_t size, uint32_t crc = 0);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "dither.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include "matcher.h"
+#include "parallel.h"
+
+DitherMode Dither::mode = DITHER_NONE;
+
+bool Dither::parseMode(string name, DitherMode *mode){
+    if (name == "none") *mode = DITHER_NONE;
+    else if (name == "floyd-steinberg") *mode = DITHER_FLOYD_STEINBERG;
+    else if (name == "atkinson") *mode = DITHER_ATKINSON;
+    else return 1;
+
+    return 0;
+}
+
+struct DiffusionWeight{
+    int x;
+    int y;
+    float weight;
+};
+
+static const DiffusionWeight floydSteinbergWeights[] = {
+    {1, 0, 7.0f / 16.0f}, {-1, 1, 3.0f / 16.0f}, {0, 1, 5.0f / 16.0f}, {1, 1, 1.0f / 16.0f}
+};
+
+// Only 6/8 of the error is passed on, which keeps contrast in flat areas
+static const DiffusionWeight atkinsonWeights[] = {
+    {1, 0, 1.0f / 8.0f}, {2, 0, 1.0f / 8.0f}, {-1, 1, 1.0f / 8.0f}, {0, 1, 1.0f / 8.0f}, {1, 1, 1.0f / 8.0f}, {0, 2, 1.0f / 8.0f}
+};
+
+vector<Tile> Dither::match(const LabPlanes &pixels, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode){
+    const DiffusionWeight *weights = (mode == DITHER_ATKINSON) ? atkinsonWeights : floydSteinbergWeights;
+    const int weightCount = (mode == DITHER_ATKINSON) ? 6 : 4;
+
+    // A row writes error at most 2 cells ahead in its own row and 1 cell 
+    // ahead in the next, so staying 4 cells behind the row above keeps 
+    // rows from ever touching the same cell at the same time
+    const unsigned int rowLag = 4;
+
+    // Error is only kept for the rows in flight. A row's error buffer is 
+    // reused "ringSize" rows later, so a row can't start before the row 
+    // that last used the buffers it writes into is done
+    if (threadCount < 1) threadCount = 1;
+    const unsigned int ringSize = threadCount + 3;
+    vector<float> errors;
+    errors.assign((uint64_t)ringSize * gridWidth * 3, 0.0f);
+
+    vector<atomic<unsigned int>> progress(gridHeight);
+    for (unsigned int y = 0; y < gridHeight; y++) progress[y] = 0;
+
+    vector<Tile> tiles;
+    tiles.resize(pixels.size());
+    TileMatcher matcher(palletTiles);
+    mutex progressMutex;
+
+    auto waitForRow = [&](int64_t row, unsigned int count){
+        if (row < 0) return;
+        while (progress[row].load(memory_order_acquire) < count) this_thread::yield();
+    };
+
+    Parallel::forEach(gridHeight, threadCount, [&](uint64_t y){
+        waitForRow((int64_t)y + 2 - ringSize, gridWidth);
+
+        float *rowErrors = &errors[(y % ringSize) * gridWidth * 3];
+        unsigned int rowAboveProgress = (y > 0) ? 0 : gridWidth;
+
+        for (unsigned int x = 0; x < gridWidth; x++){
+            unsigned int needed = min(gridWidth, x + rowLag);
+            if (rowAboveProgress < needed) {
+                waitForRow(y - 1, needed);
+                rowAboveProgress = progress[y - 1].load(memory_order_acquire);
+            }
+
+            uint64_t cell = y * gridWidth + x;
+            const CIELABColor pixel = pixels.get(cell);
+            float *error = &rowErrors[x * 3];
+
+            // The pixel's color plus the error it was handed, kept inside of CIELAB's range
+            CIELABColor target(
+                min(100.0, max(0.0, pixel.L + error[0])),
+                min(127.0, max(-128.0, pixel.a + error[1])),
+                min(127.0, max(-128.0, pixel.b + error[2])),
+                pixel.transparent
+            );
+
+            // The error is measured against the matched tile's color, not its variant's
+            Tile tile = matcher.matchTile(target, cell);
+            tile.pixelId = cell;
+            tiles[cell] = tile;
+            tiles[cell].palletId = Pallet::pickVariant(palletTiles, tile.palletId, cell);
+
+            // Transparent cells swallow their error
+            if (tile.palletId >= 0){
+                const CIELABColor &tileColor = palletTiles[tile.palletId].labColor;
+                float difference[3] = {(float)(target.L - tileColor.L), (float)(target.a - tileColor.a), (float)(target.b - tileColor.b)};
+
+                for (int w = 0; w < weightCount; w++){
+                    int64_t nx = (int64_t)x + weights[w].x;
+                    uint64_t ny = y + weights[w].y;
+                    if (nx < 0 || nx >= gridWidth || ny >= gridHeight) continue;
+
+                    float *neighbour = &errors[((ny % ringSize) * gridWidth + nx) * 3];
+                    for (int c = 0; c < 3; c++) neighbour[c] += difference[c] * weights[w].weight;
+                }
+            }
+
+            if ((x & 31) == 31 && x + 1 < gridWidth) progress[y].store(x + 1, memory_order_release);
+        }
+
+        // The buffer is handed on clean to the row "ringSize" rows down
+        fill(rowErrors, rowErrors + (uint64_t)gridWidth * 3, 0.0f);
+        progress[y].store(gridWidth, memory_order_release);
+
+        if (silentMode) return;
+        lock_guard<mutex> lock(progressMutex);
+        cout << "Progress: "
+            << (int)((float)(y + 1) / (float)gridHeight * 100) << "%"
+            << " (" << y + 1 << " / " << gridHeight << ") rows dithered\n";
+    });
+
+    matcher.printMismatchRate();
+    return tiles;
+}
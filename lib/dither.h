@@ -0,0 +1,35 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include "tile.h"
+#include "colors.h"
+#include "pallet.h"
+#include "labplanes.h"
+
+using namespace std;
+
+enum DitherMode{
+    DITHER_NONE,
+    DITHER_FLOYD_STEINBERG,
+    DITHER_ATKINSON
+};
+
+// Matches the grid while diffusing every cell's CIELAB error to the cells 
+// right of and below it. Rows run in parallel as a skewed wavefront, a 
+// row only gets to a cell once the row above it is a few cells further 
+// along, so the result is the same as matching row by row on one thread
+class Dither{
+    public:
+        static DitherMode mode;
+
+        // Parses "none", "floyd-steinberg" or "atkinson", returns "true" on error
+        static bool parseMode(string name, DitherMode *mode);
+
+        static vector<Tile> match(const LabPlanes &pixels, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode);
+};
+
+#endif
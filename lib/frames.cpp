@@ -0,0 +1,136 @@
+#include "frames.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include "mosaic.h"
+#include "matcher.h"
+#include "tilestore.h"
+#include "parallel.h"
+
+double FrameSequence::reuseDeltaE = 1.0;
+
+string FrameSequence::framePath(string framePattern, unsigned int index){
+    size_t start = framePattern.find('%');
+    if (start == string::npos) return framePattern;
+
+    size_t end = start + 1;
+    while (end < framePattern.size() && isdigit(framePattern[end])) end++;
+    if (end >= framePattern.size() || framePattern[end] != 'd') return framePattern;
+
+    // "%04d" pads with zeros to 4 digits, "%d" doesn't pad
+    unsigned int width = (end > start + 1) ? stoul(framePattern.substr(start + 1, end - start - 1)) : 0;
+    string number = to_string(index);
+    if (number.size() < width) number = string(width - number.size(), '0') + number;
+
+    return framePattern.substr(0, start) + number + framePattern.substr(end + 1);
+}
+
+bool FrameSequence::run(string framePattern, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode){
+    const unsigned int channels = 4;
+    const unsigned int tileSize = pallet.minResolution;
+
+    // Tiles are decoded the first time a frame needs them and kept for the rest
+    TileStore tileStore;
+    tileStore.openLazy(pallet);
+    TileMatcher matcher(pallet.tiles);
+
+    // Colors every cell was last matched with, drift is measured against them 
+    // so a slow fade still gets matched again once it adds up
+    vector<CIELABColor> matchedColors;
+    vector<Tile> tiles;
+    vector<uint8_t> canvas;
+
+    unsigned int frame = filesystem::exists(framePath(framePattern, 0)) ? 0 : 1;
+    unsigned int frameCount = 0;
+    for (; filesystem::exists(framePath(framePattern, frame)); frame++, frameCount++){
+        uint64_t frameStartTime = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        string frameFilePath = framePath(framePattern, frame);
+
+        LabPlanes pixels = Mosaic::fetchImagePixelCIELABColors(frameFilePath, gridWidth, gridHeight);
+        if (pixels.size() < 1) return 1;
+
+        // The first frame fixes the grid for the whole sequence
+        const bool firstFrame = tiles.size() < 1;
+        if (firstFrame) {
+            if (gridWidth > 0 || gridHeight > 0) {
+                gridWidth = Mosaic::imageWidth;
+                gridHeight = Mosaic::imageHeight;
+            }
+            tiles.resize(pixels.size());
+            matchedColors.resize(pixels.size());
+            canvas.resize((uint64_t)Mosaic::imageWidth * tileSize * Mosaic::imageHeight * tileSize * channels);
+        }
+        else if (pixels.size() != tiles.size()) {
+            cout << "error: Frame \"" << frameFilePath << "\" doesn't have the size of the first frame\n";
+            return 1;
+        }
+
+        const uint64_t width = (uint64_t)Mosaic::imageWidth * tileSize;
+        const uint64_t tileRowBytes = (uint64_t)tileSize * channels;
+        atomic<uint64_t> rematchedCells(0);
+        atomic<uint64_t> composedCells(0);
+        atomic<bool> failed(false);
+
+        Parallel::forEach(Mosaic::imageHeight, threadCount, [&](uint64_t j){
+            for (uint64_t i = 0; i < Mosaic::imageWidth; i++){
+                uint64_t pixelId = j * Mosaic::imageWidth + i;
+                CIELABColor color = pixels.get(pixelId);
+
+                if (!firstFrame && color.transparent == matchedColors[pixelId].transparent 
+                    && (color.transparent || Colors::calcDeltaE(color, matchedColors[pixelId], TileMatcher::metric) <= reuseDeltaE)) continue;
+
+                Tile tile = matcher.match(color, pixelId);
+                tile.pixelId = pixelId;
+                matchedColors[pixelId] = color;
+                rematchedCells++;
+
+                bool changed = firstFrame || tile.palletId != tiles[pixelId].palletId;
+                tiles[pixelId] = tile;
+                if (!changed) continue;
+
+                const uint8_t *tilePixels = tileStore.fetch(tile.palletId);
+                if (tilePixels == nullptr) {
+                    failed = true;
+                    continue;
+                }
+                for (uint64_t y = 0; y < tileSize; y++){
+                    uint64_t pixelIndex = ((i * tileSize) + ((y + (j * tileSize)) * width)) * channels;
+                    memcpy(canvas.data() + pixelIndex, tilePixels + y * tileRowBytes, tileRowBytes);
+                }
+                composedCells++;
+            }
+        });
+
+        if (failed) {
+            cout << "error: Unable to load pallet image file\n";
+            return 1;
+        }
+
+        // The whole frame is still encoded, every output file is a complete image
+        string outputFilePath = Mosaic::imageName + "_mosaic." + Mosaic::imageFormat;
+        ImageWriter *writer = Mosaic::createImageWriter(threadCount);
+        bool result = writer->open(outputFilePath, width, (uint64_t)Mosaic::imageHeight * tileSize, channels);
+        if (!result) result = writer->writeRows(canvas.data(), Mosaic::imageHeight * tileSize);
+        result = writer->close() || result;
+        delete writer;
+
+        if (result) {
+            cout << "error: Unable to write image file \"" << outputFilePath << "\"\n";
+            return 1;
+        }
+
+        uint64_t frameEndTime = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        if (!silentMode) cout << "Frame " << frame << ": " << rematchedCells << " / " << tiles.size() << " cells matched, "
+            << composedCells << " tiles composed in " << (double)(frameEndTime - frameStartTime) / 1000 << " s\n";
+    }
+
+    if (frameCount < 1) {
+        cout << "error: No frames found at \"" << framePath(framePattern, 1) << "\"\n";
+        return 1;
+    }
+
+    matcher.printMismatchRate();
+    cout << "Frames written: " << frameCount << "\n";
+    return 0;
+}
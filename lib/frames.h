@@ -0,0 +1,29 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include "pallet.h"
+
+using namespace std;
+
+// Turns a sequence of numbered frames into a sequence of mosaics. A cell 
+// keeps its tile while its color stays within "reuseDeltaE" of the color 
+// it was last matched with, and only cells whose tile changed are 
+// composed again, so matching and composing a frame scale with motion
+class FrameSequence{
+    public:
+        // Largest color change (deltaE in the match metric) a cell can see before it's matched again
+        static double reuseDeltaE;
+
+        // Path of frame "index", "framePattern" holds a "%d" or "%0Nd" for the number
+        static string framePath(string framePattern, unsigned int index);
+
+        // Frames are read from index 0 (or 1 if there's no frame 0) until 
+        // the first missing one, every frame is written to 
+        // "<frame name>_mosaic.<format>". Returns "true" on error
+        static bool run(string framePattern, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode);
+};
+
+#endif
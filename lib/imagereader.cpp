@@ -0,0 +1,182 @@
+#include "imagereader.h"
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include "stb_image.h"
+
+using namespace std::filesystem;
+
+ImageReader::ImageReader(){
+    width = 0;
+    height = 0;
+    channels = 0;
+    truncated = false;
+    streaming = false;
+    maxValue = 255;
+    nextRow = 0;
+    imageData = nullptr;
+}
+
+ImageReader::~ImageReader(){
+    close();
+}
+
+bool ImageReader::open(string filePath_String){
+    close();
+
+    // Nothing of the previously opened file carries over
+    width = 0;
+    height = 0;
+    channels = 0;
+    truncated = false;
+    streaming = false;
+    maxValue = 255;
+    nextRow = 0;
+
+    string filePath_abs;
+    try{
+        filePath_abs = canonical(path(filePath_String)).string();
+    } catch(const exception&){
+        cout << "error: Couldn't find image file at path \"" << filePath_String << "\"\n";
+        return 1;
+    }
+
+    // Binary netpbm files can be read row by row straight from disk
+    stream.open(filePath_abs, ios::binary);
+    if (!stream.is_open()){
+        cout << "error: Couldn't fetch image data for \"" << filePath_abs << "\"\n";
+        return 1;
+    }
+
+    if (readPNMHeader()){
+        streaming = true;
+        nextRow = 0;
+        return 0;
+    }
+    stream.close();
+
+    // Anything else is decoded in full by stb_image
+    imageData = stbi_load(filePath_abs.c_str(), &width, &height, &channels, 0);
+    if (imageData == NULL){
+        cout << "error: Couldn't fetch image data for \"" << filePath_abs << "\"\n";
+        imageData = nullptr;
+        return 1;
+    }
+
+    streaming = false;
+    nextRow = 0;
+    return 0;
+}
+
+unsigned int ImageReader::readRows(uint8_t *buffer, unsigned int rowCount){
+    if (nextRow >= (unsigned int)height || truncated) return 0;
+    if (rowCount > height - nextRow) rowCount = height - nextRow;
+
+    const uint64_t rowSize = (uint64_t)width * channels;
+
+    if (!streaming){
+        memcpy(buffer, imageData + nextRow * rowSize, rowCount * rowSize);
+        nextRow += rowCount;
+        return rowCount;
+    }
+
+    if (maxValue == 255){
+        stream.read((char*)buffer, rowCount * rowSize);
+
+        // A truncated file only yields the rows that were fully read
+        unsigned int rowsRead = stream.gcount() / rowSize;
+        if (rowsRead < rowCount) truncated = true;
+        nextRow += rowsRead;
+        return rowsRead;
+    }
+
+    // Samples are scaled to 8 bits, PNM files with a max value 
+    // above 255 store every sample as a 2 byte big-endian integer
+    const unsigned int sampleSize = (maxValue > 255) ? 2 : 1;
+    vector<uint8_t> row;
+    row.resize(rowSize * sampleSize);
+
+    unsigned int rowsRead = 0;
+    for (; rowsRead < rowCount; rowsRead++){
+        if (!stream.read((char*)row.data(), row.size())) {
+            truncated = true;
+            break;
+        }
+
+        for (uint64_t i = 0; i < rowSize; i++){
+            unsigned int sample = (sampleSize == 2) ? (row[i * 2] << 8) | row[i * 2 + 1] : row[i];
+            buffer[rowsRead * rowSize + i] = (uint8_t)((sample * 255 + maxValue / 2) / maxValue);
+        }
+    }
+
+    nextRow += rowsRead;
+    return rowsRead;
+}
+
+const uint8_t* ImageReader::decodedPixels(){
+    return streaming ? nullptr : imageData;
+}
+
+void ImageReader::close(){
+    if (stream.is_open()) stream.close();
+
+    if (imageData != nullptr){
+        stbi_image_free(imageData);
+        imageData = nullptr;
+    }
+}
+
+string ImageReader::readPNMToken(){
+    string token = "";
+    char c;
+
+    while (stream.get(c)){
+        // Comments run until the end of the line
+        if (c == '#' && token == ""){
+            while (stream.get(c) && c != '\n');
+            continue;
+        }
+
+        if (isspace((unsigned char)c)){
+            if (token != "") break;
+            continue;
+        }
+
+        token += c;
+    }
+
+    return token;
+}
+
+bool ImageReader::readPNMHeader(){
+    char magic[2];
+    if (!stream.read(magic, 2) || magic[0] != 'P') return false;
+
+    try{
+        if (magic[1] == '5' || magic[1] == '6'){
+            channels = (magic[1] == '5') ? 1 : 3;
+            width = stoi(readPNMToken());
+            height = stoi(readPNMToken());
+            maxValue = stoi(readPNMToken());
+        }
+        else if (magic[1] == '7'){
+            // PAM header is a list of "KEY value" lines closed by "ENDHDR"
+            string token = readPNMToken();
+            while (token != "ENDHDR"){
+                if (token == "") return false;
+                else if (token == "WIDTH") width = stoi(readPNMToken());
+                else if (token == "HEIGHT") height = stoi(readPNMToken());
+                else if (token == "DEPTH") channels = stoi(readPNMToken());
+                else if (token == "MAXVAL") maxValue = stoi(readPNMToken());
+                else if (token == "TUPLTYPE") readPNMToken();
+
+                token = readPNMToken();
+            }
+        }
+        else return false;
+    } catch(const exception&){
+        return false;
+    }
+
+    return width > 0 && height > 0 && channels >= 1 && channels <= 4 && maxValue > 0 && maxValue < 65536;
+}
@@ -0,0 +1,53 @@
+#ifndef IMAGEREADER_H
+#define IMAGEREADER_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <fstream>
+
+using namespace std;
+
+// Reads an image a band of scanlines at a time so the whole decoded
+// image never has to be held in memory. Binary PPM (P6), PGM (P5) and 
+// PAM (P7) files are streamed straight from disk, every other format 
+// stb_image can read is decoded in full and then handed out in bands.
+class ImageReader{
+    public:
+        int width;
+        int height;
+        int channels; // 1 for grayscale image, 3 for rgb, 4 for rgba...
+
+        // Returns "true" if the file couldn't be opened or parsed
+        bool open(string filePath_String);
+
+        // Set once the file ended before all of its rows were read
+        bool truncated;
+
+        // Reads up to "rowCount" rows of 8-bit samples into "buffer", which must
+        // hold "rowCount * width * channels" bytes. Returns the number of rows read, 
+        // fewer than asked for only at the end of the image or when "truncated" is set
+        unsigned int readRows(uint8_t *buffer, unsigned int rowCount);
+
+        // The whole decoded image for formats that aren't streamed, nullptr otherwise
+        const uint8_t* decodedPixels();
+
+        void close();
+
+        ImageReader();
+
+        ~ImageReader();
+
+    private:
+        ifstream stream;
+        bool streaming;
+        unsigned int maxValue;
+        unsigned int nextRow;
+        uint8_t *imageData;
+
+        bool readPNMHeader();
+
+        string readPNMToken();
+};
+
+#endif
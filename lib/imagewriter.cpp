@@ -0,0 +1,278 @@
+#include "imagewriter.h"
+#include <cstring>
+#include "pngwriter.h"
+
+// ImageWriter
+ImageWriter::ImageWriter(){
+    threadCount = 1;
+}
+
+ImageWriter::~ImageWriter(){
+
+}
+
+ImageWriter* ImageWriter::create(string format){
+    if (format == "png") return new PNGWriter();
+    if (format == "qoi") return new QOIWriter();
+    if (format == "ppm") return new PNMWriter(false);
+    if (format == "pam") return new PNMWriter(true);
+    if (format == "rgba") return new RawWriter();
+
+    return nullptr;
+}
+
+
+
+// BufferedFile
+BufferedFile::BufferedFile(){
+    used = 0;
+}
+
+bool BufferedFile::open(string filePath){
+    buffer.resize(1 << 20);
+    used = 0;
+
+    stream.open(filePath, ios::binary);
+    return !stream.is_open();
+}
+
+void BufferedFile::write(const uint8_t *data, uint64_t size){
+    // Big writes skip the buffer altogether
+    if (size >= buffer.size()){
+        flush();
+        stream.write((const char*)data, size);
+        return;
+    }
+
+    if (used + size > buffer.size()) flush();
+    memcpy(buffer.data() + used, data, size);
+    used += size;
+}
+
+void BufferedFile::flush(){
+    if (used > 0) stream.write((const char*)buffer.data(), used);
+    used = 0;
+}
+
+bool BufferedFile::close(){
+    if (!stream.is_open()) return 1;
+
+    flush();
+    bool failed = !stream.good();
+    stream.close();
+
+    buffer.clear();
+    buffer.shrink_to_fit();
+
+    return failed;
+}
+
+
+
+// QOIWriter
+bool QOIWriter::open(string filePath, unsigned int width, unsigned int height, unsigned int channels){
+    if (channels < 3 || channels > 4) return 1;
+    if (file.open(filePath)) return 1;
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    rowsWritten = 0;
+    run = 0;
+    previous[0] = previous[1] = previous[2] = 0;
+    previous[3] = 255;
+    memset(index, 0, sizeof(index));
+
+    const uint8_t header[14] = {
+        'q', 'o', 'i', 'f',
+        (uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t)width,
+        (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+        (uint8_t)channels, 0 // sRGB with linear alpha
+    };
+    file.write(header, 14);
+
+    return 0;
+}
+
+bool QOIWriter::writeRows(const uint8_t *rows, unsigned int rowCount){
+    if (rowsWritten + rowCount > height) return 1;
+
+    const uint64_t pixelCount = (uint64_t)width * rowCount;
+    for (uint64_t i = 0; i < pixelCount; i++){
+        const uint8_t *in = rows + i * channels;
+        uint8_t pixel[4] = {in[0], in[1], in[2], (channels == 4) ? in[3] : (uint8_t)255};
+
+        if (memcmp(pixel, previous, 4) == 0){
+            run++;
+            if (run == 62){
+                file.put(0xC0 | (run - 1)); // QOI_OP_RUN
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0){
+            file.put(0xC0 | (run - 1)); // QOI_OP_RUN
+            run = 0;
+        }
+
+        unsigned int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+        if (memcmp(index[hash], pixel, 4) == 0){
+            file.put(hash); // QOI_OP_INDEX
+        }
+        else {
+            memcpy(index[hash], pixel, 4);
+
+            if (pixel[3] == previous[3]){
+                int8_t dr = pixel[0] - previous[0];
+                int8_t dg = pixel[1] - previous[1];
+                int8_t db = pixel[2] - previous[2];
+                int8_t dr_dg = dr - dg;
+                int8_t db_dg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+                    file.put(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)); // QOI_OP_DIFF
+                }
+                else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7){
+                    file.put(0x80 | (dg + 32)); // QOI_OP_LUMA
+                    file.put(((dr_dg + 8) << 4) | (db_dg + 8));
+                }
+                else {
+                    file.put(0xFE); // QOI_OP_RGB
+                    file.put(pixel[0]);
+                    file.put(pixel[1]);
+                    file.put(pixel[2]);
+                }
+            }
+            else {
+                file.put(0xFF); // QOI_OP_RGBA
+                file.put(pixel[0]);
+                file.put(pixel[1]);
+                file.put(pixel[2]);
+                file.put(pixel[3]);
+            }
+        }
+
+        memcpy(previous, pixel, 4);
+    }
+
+    rowsWritten += rowCount;
+    return 0;
+}
+
+bool QOIWriter::close(){
+    if (run > 0) file.put(0xC0 | (run - 1)); // QOI_OP_RUN
+    run = 0;
+
+    const uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    file.write(padding, 8);
+
+    bool failed = rowsWritten != height;
+    return file.close() || failed;
+}
+
+
+
+// PNMWriter
+PNMWriter::PNMWriter(bool pam){
+    this->pam = pam;
+}
+
+bool PNMWriter::open(string filePath, unsigned int width, unsigned int height, unsigned int channels){
+    if (channels < 1 || channels > 4) return 1;
+    if (file.open(filePath)) return 1;
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    rowsWritten = 0;
+
+    // PPM has no alpha channel, gray images are written as PGM
+    outputChannels = pam ? channels : (channels <= 2) ? 1 : 3;
+    string header = PNMWriter::header(pam, width, height, channels);
+    file.write((const uint8_t*)header.data(), header.size());
+
+    return 0;
+}
+
+string PNMWriter::header(bool pam, unsigned int width, unsigned int height, unsigned int channels){
+    if (pam){
+        const string tupleTypes[5] = {"", "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA"};
+        return "P7\nWIDTH " + to_string(width) + "\nHEIGHT " + to_string(height)
+            + "\nDEPTH " + to_string(channels) + "\nMAXVAL 255\nTUPLTYPE " + tupleTypes[channels] + "\nENDHDR\n";
+    }
+
+    return string((channels <= 2) ? "P5\n" : "P6\n") + to_string(width) + " " + to_string(height) + "\n255\n";
+}
+
+bool PNMWriter::writeRows(const uint8_t *rows, unsigned int rowCount){
+    if (rowsWritten + rowCount > height) return 1;
+
+    if (outputChannels == channels){
+        file.write(rows, (uint64_t)width * rowCount * channels);
+    }
+    else {
+        const uint64_t pixelCount = (uint64_t)width * rowCount;
+        for (uint64_t i = 0; i < pixelCount; i++){
+            for (unsigned int c = 0; c < outputChannels; c++) file.put(rows[i * channels + c]);
+        }
+    }
+
+    rowsWritten += rowCount;
+    return 0;
+}
+
+bool PNMWriter::close(){
+    bool failed = rowsWritten != height;
+    return file.close() || failed;
+}
+
+
+
+// RawWriter
+bool RawWriter::open(string filePath, unsigned int width, unsigned int height, unsigned int channels){
+    if (channels < 1 || channels > 4) return 1;
+    if (file.open(filePath)) return 1;
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    rowsWritten = 0;
+
+    return writeDescriptor(filePath, width, height, channels);
+}
+
+bool RawWriter::writeDescriptor(string filePath, unsigned int width, unsigned int height, unsigned int channels){
+    // The sidecar only needs the raw file's name since both sit in the same directory
+    string fileName = filePath;
+    size_t separator = fileName.find_last_of("/\\");
+    if (separator != string::npos) fileName = fileName.substr(separator + 1);
+
+    string jsonText = "{\"width\": " + to_string(width) + ", "
+        + "\"height\": " + to_string(height) + ", "
+        + "\"channels\": " + to_string(channels) + ", "
+        + "\"bitDepth\": 8, "
+        + "\"rowStride\": " + to_string((uint64_t)width * channels) + ", "
+        + "\"dataFile\": \"" + fileName + "\"}";
+
+    ofstream descriptor_stream(filePath + ".json");
+    if (!descriptor_stream.is_open()) return 1;
+    descriptor_stream << jsonText;
+    descriptor_stream.close();
+
+    return 0;
+}
+
+bool RawWriter::writeRows(const uint8_t *rows, unsigned int rowCount){
+    if (rowsWritten + rowCount > height) return 1;
+
+    file.write(rows, (uint64_t)width * rowCount * channels);
+
+    rowsWritten += rowCount;
+    return 0;
+}
+
+bool RawWriter::close(){
+    bool failed = rowsWritten != height;
+    return file.close() || failed;
+}
@@ -0,0 +1,126 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+// Streaming image encoder, rows of 8-bit samples are appended top to bottom
+class ImageWriter{
+    public:
+        // Encoders that can use more than one thread do so
+        unsigned int threadCount;
+
+        // Returns "true" if the file couldn't be created
+        virtual bool open(string filePath, unsigned int width, unsigned int height, unsigned int channels) = 0;
+
+        // Appends "rowCount" rows of "width * channels" bytes, returns "true" on error
+        virtual bool writeRows(const uint8_t *rows, unsigned int rowCount) = 0;
+
+        // Finishes the file, returns "true" on error
+        virtual bool close() = 0;
+
+        // Creates the encoder for "png", "qoi", "ppm", "pam" or "rgba", nullptr if unknown.
+        // Files are expected to be named with the format as their extension
+        static ImageWriter* create(string format);
+
+        ImageWriter();
+
+        virtual ~ImageWriter();
+};
+
+// Output file with a big write buffer so encoders can emit single bytes cheaply
+class BufferedFile{
+    public:
+        bool open(string filePath);
+
+        inline void put(uint8_t byte){
+            if (used == buffer.size()) flush();
+            buffer[used++] = byte;
+        }
+
+        void write(const uint8_t *data, uint64_t size);
+
+        void flush();
+
+        // Returns "true" if anything failed to be written
+        bool close();
+
+        BufferedFile();
+
+    private:
+        ofstream stream;
+        vector<uint8_t> buffer;
+        uint64_t used;
+};
+
+// Quite OK Image format, lossless and far cheaper to encode than deflate
+class QOIWriter : public ImageWriter{
+    public:
+        bool open(string filePath, unsigned int width, unsigned int height, unsigned int channels) override;
+
+        bool writeRows(const uint8_t *rows, unsigned int rowCount) override;
+
+        bool close() override;
+
+    private:
+        BufferedFile file;
+        unsigned int width;
+        unsigned int height;
+        unsigned int channels;
+        unsigned int rowsWritten;
+        uint8_t previous[4];
+        uint8_t index[64][4];
+        unsigned int run;
+};
+
+// Binary netpbm, PPM (P6) drops the alpha channel, PAM (P7) keeps it
+class PNMWriter : public ImageWriter{
+    public:
+        bool pam;
+
+        bool open(string filePath, unsigned int width, unsigned int height, unsigned int channels) override;
+
+        bool writeRows(const uint8_t *rows, unsigned int rowCount) override;
+
+        bool close() override;
+
+        // Header of a "width x height" file with "channels" channels
+        static string header(bool pam, unsigned int width, unsigned int height, unsigned int channels);
+
+        PNMWriter(bool pam);
+
+    private:
+        BufferedFile file;
+        unsigned int width;
+        unsigned int height;
+        unsigned int channels;
+        unsigned int outputChannels;
+        unsigned int rowsWritten;
+};
+
+// Headerless RGBA rows plus a "<file>.json" sidecar describing their layout
+class RawWriter : public ImageWriter{
+    public:
+        bool open(string filePath, unsigned int width, unsigned int height, unsigned int channels) override;
+
+        bool writeRows(const uint8_t *rows, unsigned int rowCount) override;
+
+        bool close() override;
+
+        // Writes the "<filePath>.json" sidecar, returns "true" on error
+        static bool writeDescriptor(string filePath, unsigned int width, unsigned int height, unsigned int channels);
+
+    private:
+        BufferedFile file;
+        unsigned int width;
+        unsigned int height;
+        unsigned int channels;
+        unsigned int rowsWritten;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "incremental.h"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include "mosaic.h"
+#include "matcher.h"
+#include "imagereader.h"
+#include "imagewriter.h"
+#include "tilestore.h"
+#include "parallel.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Whether "filePath" is exactly "header" followed by "width x height" RGBA pixels, 
+// which is what "pam" and "rgba" mosaics are, so their tiles can be patched in place
+static bool hasRawLayout(string filePath, string header, uint64_t width, uint64_t height){
+    error_code error;
+    uint64_t fileSize = filesystem::file_size(filePath, error);
+    if (error || fileSize != header.size() + width * height * 4) return 0;
+
+    ifstream stream(filePath, ios::binary);
+    string fileHeader(header.size(), '\0');
+    stream.read(fileHeader.data(), fileHeader.size());
+    return stream && fileHeader == header;
+}
+
+// Copies the tiles of the cells in "composeCells" over the raw mosaic at "filePath", 
+// a seek and a write per tile row, nothing else in the file is touched. Returns "true" on error
+static bool patchRawImage(string filePath, uint64_t headerSize, const vector<Tile> &tiles, const vector<uint8_t> &composeCells, 
+    const TileStore &tileStore, unsigned int tileSize, bool silentMode){
+    const uint64_t width = (uint64_t)Mosaic::imageWidth * tileSize;
+    const uint64_t tileRowBytes = (uint64_t)tileSize * 4;
+
+    fstream stream(filePath, ios::in | ios::out | ios::binary);
+    if (!stream) return 1;
+
+    for (uint64_t j = 0; j < Mosaic::imageHeight && stream; j++){
+        for (uint64_t i = 0; i < Mosaic::imageWidth; i++){
+            uint64_t pixelId = j * Mosaic::imageWidth + i;
+            if (!composeCells[pixelId]) continue;
+
+            const uint8_t *tilePixels = tileStore.pixels(tiles[pixelId].palletId);
+            for (uint64_t y = 0; y < tileSize; y++){
+                stream.seekp(headerSize + ((j * tileSize + y) * width + i * tileSize) * 4);
+                stream.write((const char*)tilePixels + y * tileRowBytes, tileRowBytes);
+            }
+        }
+
+        if (!silentMode) cout << "Progress: " << (int)((float)(j + 1) / (float)Mosaic::imageHeight * 100) << "%"
+            << " (" << j + 1 << " / " << Mosaic::imageHeight << ") tile rows patched\n";
+    }
+
+    stream.close();
+    return stream.fail();
+}
+
+// Encodes the mosaic a tile row at a time into "filePath". Cells outside "composeCells" 
+// are copied from "previous" when it's open, so only one band is ever held in memory. Returns "true" on error
+static bool writeImage(string filePath, ImageReader *previous, const vector<Tile> &tiles, const vector<uint8_t> &composeCells, 
+    const TileStore &tileStore, unsigned int tileSize, unsigned int threadCount, bool silentMode){
+    const unsigned int channels = 4;
+    const uint64_t width = (uint64_t)Mosaic::imageWidth * tileSize;
+    const uint64_t tileRowBytes = (uint64_t)tileSize * channels;
+
+    vector<uint8_t> band;
+    band.resize(width * tileSize * channels);
+    vector<uint8_t> row;
+    if (previous != nullptr) row.resize(width * previous->channels);
+
+    ImageWriter *writer = Mosaic::createImageWriter(threadCount);
+    bool result = writer->open(filePath, width, (uint64_t)Mosaic::imageHeight * tileSize, channels);
+
+    for (uint64_t j = 0; j < Mosaic::imageHeight && !result; j++){
+        for (uint64_t y = 0; y < tileSize && previous != nullptr && !result; y++){
+            const unsigned int previousChannels = previous->channels;
+            result = previous->readRows(row.data(), 1) < 1;
+
+            uint8_t *out = band.data() + y * width * channels;
+            for (uint64_t x = 0; x < width && !result; x++){
+                const uint8_t *pixel = row.data() + x * previousChannels;
+                out[x * 4] = pixel[0];
+                out[x * 4 + 1] = (previousChannels < 3) ? pixel[0] : pixel[1];
+                out[x * 4 + 2] = (previousChannels < 3) ? pixel[0] : pixel[2];
+                out[x * 4 + 3] = (previousChannels == 2 || previousChannels == 4) ? pixel[previousChannels - 1] : 255;
+            }
+        }
+
+        for (uint64_t i = 0; i < Mosaic::imageWidth && !result; i++){
+            uint64_t pixelId = j * Mosaic::imageWidth + i;
+            if (!composeCells[pixelId]) continue;
+
+            const uint8_t *tilePixels = tileStore.pixels(tiles[pixelId].palletId);
+            for (uint64_t y = 0; y < tileSize; y++){
+                memcpy(band.data() + (y * width + i * tileSize) * channels, tilePixels + y * tileRowBytes, tileRowBytes);
+            }
+        }
+
+        if (!result) result = writer->writeRows(band.data(), tileSize);
+
+        if (!silentMode) cout << "Progress: " << (int)((float)(j + 1) / (float)Mosaic::imageHeight * 100) << "%"
+            << " (" << j + 1 << " / " << Mosaic::imageHeight << ") tile rows written\n";
+    }
+
+    result = writer->close() || result;
+    delete writer;
+
+    return result;
+}
+
+bool IncrementalRender::run(string inputImagePath, string previousImagePath, string previousManifestPath, const Pallet &pallet, string palletFilePath, 
+    unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode, vector<Tile> &tiles){
+    const unsigned int channels = 4;
+    const unsigned int tileSize = pallet.minResolution;
+
+    unsigned int manifestWidth;
+    unsigned int manifestHeight;
+    vector<int> previousPalletIds;
+    try{
+        ifstream manifest_stream(previousManifestPath);
+        json manifest = json::parse(manifest_stream);
+
+        if (manifest["palletFilePath"] != palletFilePath) {
+            cout << "error: \"" << previousManifestPath << "\" was made with another pallet\n";
+            return 1;
+        }
+
+        manifestWidth = manifest["width"];
+        manifestHeight = manifest["height"];
+        for (const json &tile : manifest["tiles"]) {
+            // Cells of adaptive blocks only hold part of their tile
+            if (tile.contains("blockSize")) {
+                cout << "error: Adaptive mosaics can't be rendered incrementally\n";
+                return 1;
+            }
+            previousPalletIds.push_back(tile["palletTileId"]);
+        }
+    } catch(const exception&){
+        cout << "error: Unable to read previous manifest \"" << previousManifestPath << "\"\n";
+        return 1;
+    }
+
+    // Both inputs go through the grid filter the fused match uses, so a cell 
+    // whose source pixels didn't change ends up with exactly the same color 
+    // and a changed one is matched with the color a full run would see. The 
+    // new input goes last so the image name and size are the new image's
+    LabPlanes previousPixels = Mosaic::fetchImagePixelCIELABColors(previousImagePath, gridWidth, gridHeight);
+    if (previousPixels.size() < 1) return 1;
+    const string previousOutputFilePath = Mosaic::imageName + "_mosaic." + Mosaic::imageFormat;
+
+    LabPlanes pixels = Mosaic::fetchImagePixelCIELABColors(inputImagePath, gridWidth, gridHeight);
+    if (pixels.size() < 1) return 1;
+    const string outputFilePath = Mosaic::imageName + "_mosaic." + Mosaic::imageFormat;
+
+    if (Mosaic::imageWidth != manifestWidth || Mosaic::imageHeight != manifestHeight 
+        || previousPixels.size() != pixels.size() || previousPalletIds.size() != pixels.size()) {
+        cout << "error: The previous mosaic has a different grid size, it has to be made with the same grid options\n";
+        return 1;
+    }
+
+    const uint64_t width = (uint64_t)Mosaic::imageWidth * tileSize;
+    const uint64_t height = (uint64_t)Mosaic::imageHeight * tileSize;
+
+    TileMatcher matcher(pallet.tiles);
+    tiles.resize(pixels.size());
+    vector<uint8_t> composeCells;
+    composeCells.resize(pixels.size());
+    atomic<uint64_t> rematchedCells(0);
+
+    Parallel::forEach(Mosaic::imageHeight, threadCount, [&](uint64_t j){
+        for (uint64_t i = 0; i < Mosaic::imageWidth; i++){
+            uint64_t pixelId = j * Mosaic::imageWidth + i;
+            CIELABColor color = pixels.get(pixelId);
+            int previousPalletId = previousPalletIds[pixelId];
+
+            bool unchanged = previousPixels.L[pixelId] == pixels.L[pixelId] && previousPixels.a[pixelId] == pixels.a[pixelId] 
+                && previousPixels.b[pixelId] == pixels.b[pixelId] && previousPixels.isTransparent(pixelId) == pixels.isTransparent(pixelId);
+            if (unchanged && previousPalletId < (int)pallet.tileCount()) {
+                tiles[pixelId].palletId = previousPalletId;
+                if (previousPalletId >= 0) tiles[pixelId].closestDeltaE = Colors::calcDeltaE(color, pallet.fetchTile(previousPalletId).labColor, TileMatcher::metric);
+            }
+            else {
+                tiles[pixelId] = matcher.match(color, pixelId);
+                rematchedCells++;
+            }
+            tiles[pixelId].pixelId = pixelId;
+            composeCells[pixelId] = tiles[pixelId].palletId != previousPalletId;
+        }
+    });
+
+    matcher.printMismatchRate();
+
+    // "pam" and "rgba" mosaics are patched in place, anything compressed is 
+    // encoded again, reading the unchanged cells from the previous image
+    string rawHeader;
+    bool raw = Mosaic::imageFormat == "rgba" || Mosaic::imageFormat == "pam";
+    if (Mosaic::imageFormat == "pam") rawHeader = PNMWriter::header(true, width, height, channels);
+    raw = raw && hasRawLayout(previousOutputFilePath, rawHeader, width, height);
+
+    ImageReader previous;
+    bool composeAll = !raw && (previous.open(previousOutputFilePath) || (uint64_t)previous.width != width || (uint64_t)previous.height != height);
+    if (composeAll) {
+        cout << "Warning: Unable to read previous mosaic image \"" << previousOutputFilePath << "\", composing every tile\n";
+        fill(composeCells.begin(), composeCells.end(), 1);
+    }
+
+    vector<Tile> composedTiles;
+    for (uint64_t pixelId = 0; pixelId < tiles.size(); pixelId++){
+        if (composeCells[pixelId]) composedTiles.push_back(tiles[pixelId]);
+    }
+    cout << "Incremental render: " << rematchedCells << " / " << tiles.size() << " cells matched again, " << composedTiles.size() << " tiles composed\n";
+
+    TileStore tileStore;
+    if (tileStore.load(composedTiles, pallet, threadCount)) return 1;
+
+    cout << "\nWriting image data to file...\n";
+    bool result;
+    if (raw) {
+        error_code error;
+        if (outputFilePath != previousOutputFilePath) filesystem::copy_file(previousOutputFilePath, outputFilePath, filesystem::copy_options::overwrite_existing, error);
+        result = error || patchRawImage(outputFilePath, rawHeader.size(), tiles, composeCells, tileStore, tileSize, silentMode);
+        if (!result && Mosaic::imageFormat == "rgba") result = RawWriter::writeDescriptor(outputFilePath, width, height, channels);
+    }
+    else if (composeAll || outputFilePath != previousOutputFilePath) {
+        result = writeImage(outputFilePath, composeAll ? nullptr : &previous, tiles, composeCells, tileStore, tileSize, threadCount, silentMode);
+    }
+    else {
+        // The previous image is still being read while the new one is written
+        string tempFilePath = outputFilePath + ".tmp";
+        result = writeImage(tempFilePath, &previous, tiles, composeCells, tileStore, tileSize, threadCount, silentMode);
+        previous.close();
+        error_code error;
+        if (!result) filesystem::rename(tempFilePath, outputFilePath, error);
+        else filesystem::remove(tempFilePath, error);
+        result = result || error;
+    }
+
+    if (result) cout << "error: Unable to write image file \"" << outputFilePath << "\"\n";
+    return result;
+}
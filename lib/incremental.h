@@ -0,0 +1,25 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include "tile.h"
+#include "pallet.h"
+
+using namespace std;
+
+// Re-renders a mosaic after its input image was edited. The old and new 
+// input are both box-filtered to the grid and compared cell by cell, only 
+// cells whose color changed are matched again and only tiles that changed 
+// are copied over the previous mosaic image. "pam" and "rgba" mosaics are 
+// patched in place, other formats are encoded again a tile row at a time
+class IncrementalRender{
+    public:
+        // "tiles" gets every cell's match for the new manifest, returns "true" on error
+        static bool run(string inputImagePath, string previousImagePath, string previousManifestPath, const Pallet &pallet, string palletFilePath, 
+            unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode, vector<Tile> &tiles);
+};
+
+#endif
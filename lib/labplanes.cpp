@@ -0,0 +1,17 @@
+#include "labplanes.h"
+
+void LabPlanes::set(uint64_t i, const CIELABColor &color){
+    L[i] = color.L;
+    a[i] = color.a;
+    b[i] = color.b;
+
+    if (color.transparent) transparentMask[i >> 6] |= (uint64_t)1 << (i & 63);
+    else transparentMask[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+void LabPlanes::resize(uint64_t size){
+    L.resize(size);
+    a.resize(size);
+    b.resize(size);
+    transparentMask.resize((size + 63) / 64, 0);
+}
@@ -0,0 +1,41 @@
+#ifndef LABPLANES_H
+#define LABPLANES_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include "colors.h"
+
+using namespace std;
+
+// CIELAB pixels kept as three float planes with the transparency flags 
+// packed into a bit plane, 12 bytes and a bit per pixel instead of the 
+// 32 a CIELABColor takes. The grid filter already rounds its colors to 
+// float, so the planes hold them exactly. Each plane is contiguous, so a 
+// run of pixels loads straight into vector registers
+class LabPlanes{
+    public:
+        vector<float> L;
+        vector<float> a;
+        vector<float> b;
+        vector<uint64_t> transparentMask;
+
+        inline uint64_t size() const {
+            return L.size();
+        }
+
+        inline bool isTransparent(uint64_t i) const {
+            return (transparentMask[i >> 6] >> (i & 63)) & 1;
+        }
+
+        inline CIELABColor get(uint64_t i) const {
+            return CIELABColor(L[i], a[i], b[i], isTransparent(i));
+        }
+
+        // Not safe to call for pixels sharing a 64 pixel word from different threads
+        void set(uint64_t i, const CIELABColor &color);
+
+        void resize(uint64_t size);
+};
+
+#endif
@@ -0,0 +1,112 @@
+// Platform headers go first, windows.h breaks after "using namespace std"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "mappedfile.h"
+
+MappedFile::MappedFile(){
+    data = nullptr;
+    size = 0;
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+    mappingHandle = NULL;
+#else
+    fileDescriptor = -1;
+#endif
+}
+
+MappedFile::~MappedFile(){
+    close();
+}
+
+#ifdef _WIN32
+bool MappedFile::create(string filePath, uint64_t size){
+    close();
+
+    fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) return 1;
+
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (mappingHandle == NULL){
+        close();
+        return 1;
+    }
+
+    data = (uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, size);
+    if (data == NULL){
+        data = nullptr;
+        close();
+        return 1;
+    }
+
+    this->size = size;
+    return 0;
+}
+
+bool MappedFile::close(){
+    bool failed = false;
+
+    // Dirty pages are written back by the OS on its own schedule
+    if (data != nullptr){
+        failed = !UnmapViewOfFile(data);
+        data = nullptr;
+    }
+    if (mappingHandle != NULL){
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE){
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    size = 0;
+    return failed;
+}
+#else
+bool MappedFile::create(string filePath, uint64_t size){
+    close();
+
+    fileDescriptor = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fileDescriptor < 0) return 1;
+
+    if (ftruncate(fileDescriptor, size) != 0){
+        close();
+        return 1;
+    }
+
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if (mapping == MAP_FAILED){
+        close();
+        return 1;
+    }
+
+    data = (uint8_t*)mapping;
+    this->size = size;
+    return 0;
+}
+
+bool MappedFile::close(){
+    bool failed = false;
+
+    // Dirty pages are written back by the OS on its own schedule
+    if (data != nullptr){
+        failed = munmap(data, size) != 0;
+        data = nullptr;
+    }
+    if (fileDescriptor >= 0){
+        failed = (::close(fileDescriptor) != 0) || failed;
+        fileDescriptor = -1;
+    }
+
+    size = 0;
+    return failed;
+}
+#endif
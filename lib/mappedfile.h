@@ -0,0 +1,37 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#pragma once
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// File mapped into memory for writing, so data can be composed straight 
+// into it and the OS pages it out to disk under memory pressure
+class MappedFile{
+    public:
+        uint8_t *data;
+        uint64_t size;
+
+        // Creates (or truncates) the file at "size" bytes and maps 
+        // all of it, returns "true" on error
+        bool create(string filePath, uint64_t size);
+
+        // Unmaps and closes the file, returns "true" on error
+        bool close();
+
+        MappedFile();
+
+        ~MappedFile();
+
+    private:
+#ifdef _WIN32
+        void *fileHandle;
+        void *mappingHandle;
+#else
+        int fileDescriptor;
+#endif
+};
+
+#endif
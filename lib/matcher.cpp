@@ -0,0 +1,351 @@
+#include "matcher.h"
+#include <cmath>
+#include <algorithm>
+#include "mosaic.h"
+
+double TileMatcher::maxExtraDeltaE = -1;
+DeltaEMetric TileMatcher::metric = DELTAE_CIE76;
+vector<palletCluster> TileMatcher::palletClusters;
+
+TileMatcher::TileMatcher(const vector<palletTile> &palletTiles, bool forceIndex) : palletTiles(palletTiles){
+    this->approximate = maxExtraDeltaE >= 0 && palletTiles.size() > 0;
+    this->indexed = (forceIndex || approximate || metric != DELTAE_CIE76) && palletTiles.size() > 0;
+    this->sampledMatches = 0;
+    this->mismatchedMatches = 0;
+    this->sampledExtraDeltaE = 0;
+    this->maxSampledExtraDeltaE = 0;
+    this->maxTileChroma = 0;
+    this->maxTileLightnessOffset = 0;
+    this->clustered = false;
+
+    if (indexed) buildGrid();
+    else if (metric == DELTAE_CIE76 && palletClusters.size() > 1) buildClusters();
+}
+
+// 25^7, where the CIEDE2000 chroma weighting is halfway
+static const double pow25_7 = 6103515625.0;
+
+static inline double chroma(const CIELABColor &color){
+    return sqrt(color.a * color.a + color.b * color.b);
+}
+
+static inline double lightnessWeight(double lightnessOffset){
+    return 1.0 + (0.015 * lightnessOffset * lightnessOffset) / sqrt(20.0 + lightnessOffset * lightnessOffset);
+}
+
+// Lower bound of the CIEDE2000 chroma and hue term relative to the 
+// Euclidean a*b* distance when the mean chroma is at most "meanChroma". 
+// a* only ever gets stretched, by 1.5 at most, the chroma weight is 
+// bigger than the hue weight and the rotation term can take away at 
+// most "RC * sin(60°) / 2" of the sum of the squared terms
+static inline double chromaHueFactor(double meanChroma){
+    double meanChromaP = 1.5 * meanChroma;
+    double meanChromaP3 = meanChromaP * meanChromaP * meanChromaP;
+    double meanChromaP7 = meanChromaP3 * meanChromaP3 * meanChromaP;
+    double RC = 2.0 * sqrt(meanChromaP7 / (meanChromaP7 + pow25_7));
+    double SC = 1.0 + 0.045 * meanChromaP;
+
+    return sqrt(1.0 - RC * 0.8660254037844386 / 2.0) / SC;
+}
+
+double TileMatcher::lowerBoundFactor(const CIELABColor &pixel, double pixelChroma){
+    switch (metric){
+        // The chroma and hue weights are at least 1 and grow with the reference's chroma
+        case DELTAE_CIE94: return 1.0 / (1.0 + 0.045 * pixelChroma);
+        case DELTAE_CIEDE2000: {
+            double lightnessOffset = max(fabs(pixel.L - 50.0), maxTileLightnessOffset);
+            return min(1.0 / lightnessWeight(lightnessOffset), chromaHueFactor((pixelChroma + maxTileChroma) / 2.0));
+        }
+        default: return 1.0;
+    }
+}
+
+double TileMatcher::lowerBound2000(const CIELABColor &pixel, double pixelChroma, int palletId, double deltaL, double deltaAB2){
+    double L = deltaL / lightnessWeight((pixel.L + palletTiles[palletId].labColor.L) / 2.0 - 50.0);
+    double CH = chromaHueFactor((pixelChroma + tileChroma[palletId]) / 2.0);
+
+    return L * L + CH * CH * deltaAB2;
+}
+
+static inline void labCoordinates(const CIELABColor &color, double *coordinates){
+    coordinates[0] = color.L;
+    coordinates[1] = color.a;
+    coordinates[2] = color.b;
+}
+
+void TileMatcher::buildGrid(){
+    tileChroma.resize(palletTiles.size());
+    for (uint64_t i = 0; i < palletTiles.size(); i++){
+        tileChroma[i] = chroma(palletTiles[i].labColor);
+        maxTileChroma = max(maxTileChroma, tileChroma[i]);
+        maxTileLightnessOffset = max(maxTileLightnessOffset, fabs(palletTiles[i].labColor.L - 50.0));
+    }
+
+    double gridMax[3];
+    labCoordinates(palletTiles[0].labColor, gridMin);
+    labCoordinates(palletTiles[0].labColor, gridMax);
+    for (uint64_t i = 1; i < palletTiles.size(); i++){
+        double coordinates[3];
+        labCoordinates(palletTiles[i].labColor, coordinates);
+        for (int k = 0; k < 3; k++){
+            gridMin[k] = min(gridMin[k], coordinates[k]);
+            gridMax[k] = max(gridMax[k], coordinates[k]);
+        }
+    }
+
+    // Aim for about one tile per cell if the tiles were spread evenly
+    double extent = max(max(gridMax[0] - gridMin[0], gridMax[1] - gridMin[1]), gridMax[2] - gridMin[2]);
+    double cellsPerSide = min(64.0, max(1.0, ceil(cbrt((double)palletTiles.size()))));
+    cellSize = max(extent / cellsPerSide, 1e-6);
+    for (int k = 0; k < 3; k++) gridSize[k] = (int)((gridMax[k] - gridMin[k]) / cellSize) + 1;
+
+    // Tiles are laid out cell by cell, in pallet order within every cell
+    uint64_t cellCount = (uint64_t)gridSize[0] * gridSize[1] * gridSize[2];
+    vector<uint32_t> tileCells;
+    tileCells.resize(palletTiles.size());
+    cellStart.assign(cellCount + 1, 0);
+    for (uint64_t i = 0; i < palletTiles.size(); i++){
+        double coordinates[3];
+        labCoordinates(palletTiles[i].labColor, coordinates);
+
+        int cell[3];
+        for (int k = 0; k < 3; k++) cell[k] = min(gridSize[k] - 1, (int)((coordinates[k] - gridMin[k]) / cellSize));
+        tileCells[i] = ((uint64_t)cell[0] * gridSize[1] + cell[1]) * gridSize[2] + cell[2];
+        cellStart[tileCells[i] + 1]++;
+    }
+    for (uint64_t c = 0; c < cellCount; c++) cellStart[c + 1] += cellStart[c];
+
+    vector<uint32_t> nextSlot(cellStart.begin(), cellStart.end() - 1);
+    cellTiles.resize(palletTiles.size());
+    for (uint64_t i = 0; i < palletTiles.size(); i++) cellTiles[nextSlot[tileCells[i]]++] = i;
+}
+
+void TileMatcher::buildClusters(){
+    // Clusters made for another set of tiles (like a pallet shard's) aren't used
+    uint64_t memberCount = 0;
+    for (const palletCluster &cluster : palletClusters){
+        for (int palletId : cluster.palletIds){
+            if (palletId < 0 || (uint64_t)palletId >= palletTiles.size()) return;
+        }
+        memberCount += cluster.palletIds.size();
+    }
+    if (memberCount != palletTiles.size()) return;
+
+    clusterStart.push_back(0);
+    for (const palletCluster &cluster : palletClusters){
+        for (int palletId : cluster.palletIds){
+            memberL.push_back(palletTiles[palletId].labColor.L);
+            memberA.push_back(palletTiles[palletId].labColor.a);
+            memberB.push_back(palletTiles[palletId].labColor.b);
+            memberIds.push_back(palletId);
+        }
+        clusterStart.push_back(memberIds.size());
+    }
+
+    clustered = true;
+}
+
+Tile TileMatcher::matchClustered(const CIELABColor &pixel){
+    thread_local vector<pair<double, uint32_t>> clusterOrder;
+    thread_local vector<double> deltaEs;
+
+    // By the triangle inequality no member is closer than the centroid's distance minus the radius
+    clusterOrder.resize(palletClusters.size());
+    for (uint32_t c = 0; c < palletClusters.size(); c++){
+        clusterOrder[c].first = Colors::calcDeltaE(pixel, palletClusters[c].centroid) - palletClusters[c].radius;
+        clusterOrder[c].second = c;
+    }
+    sort(clusterOrder.begin(), clusterOrder.end());
+
+    Tile tile;
+    tile.palletId = -1;
+    for (const pair<double, uint32_t> &cluster : clusterOrder){
+        // A cluster that could hold an equally close tile with a lower palletId still gets searched
+        if (cluster.first - 1e-9 > tile.closestDeltaE) break;
+
+        uint32_t start = clusterStart[cluster.second];
+        uint32_t count = clusterStart[cluster.second + 1] - start;
+        const double *L = memberL.data() + start;
+        const double *A = memberA.data() + start;
+        const double *B = memberB.data() + start;
+
+        // Same arithmetic as "Colors::calcDeltaE" without branches, so the compiler can vectorize it
+        deltaEs.resize(count);
+        for (uint32_t i = 0; i < count; i++){
+            double deltaL = L[i] - pixel.L;
+            double deltaA = A[i] - pixel.a;
+            double deltaB = B[i] - pixel.b;
+            deltaEs[i] = sqrt(deltaL * deltaL + deltaA * deltaA + deltaB * deltaB);
+        }
+
+        for (uint32_t i = 0; i < count; i++){
+            int palletId = memberIds[start + i];
+            if (deltaEs[i] < tile.closestDeltaE || (deltaEs[i] == tile.closestDeltaE && palletId < tile.palletId)) {
+                tile.closestDeltaE = deltaEs[i];
+                tile.palletId = palletId;
+            }
+        }
+    }
+
+    return tile;
+}
+
+Tile TileMatcher::matchGrid(const CIELABColor &pixel){
+    vector<Tile> nearest;
+    matchNearest(pixel, 1, nearest);
+
+    return nearest[0];
+}
+
+// Ranks tiles by deltaE and then palletId, so the same tiles are always kept
+static inline bool closerTile(const Tile &a, const Tile &b){
+    return (a.closestDeltaE != b.closestDeltaE) ? a.closestDeltaE < b.closestDeltaE : a.palletId < b.palletId;
+}
+
+void TileMatcher::matchNearest(const CIELABColor &pixel, unsigned int count, vector<Tile> &nearest, function<bool(int)> usable){
+    nearest.clear();
+    if (count < 1) return;
+
+    // Kept as a max-heap while searching so the worst kept tile is always at the 
+    // front and replacing it stays cheap however many tiles are asked for
+    nearest.reserve(min((uint64_t)count, (uint64_t)palletTiles.size()));
+    const double allowedError = approximate ? maxExtraDeltaE : 0;
+    const double pixelChroma = chroma(pixel);
+    const double boundFactor = lowerBoundFactor(pixel, pixelChroma);
+
+    double coordinates[3];
+    labCoordinates(pixel, coordinates);
+
+    // The pixel's cell can lie outside of the grid, search starts 
+    // at the first ring of cells around it that reaches into the grid
+    int64_t center[3];
+    int64_t firstRing = 0;
+    int64_t lastRing = 0;
+    for (int k = 0; k < 3; k++){
+        center[k] = (int64_t)floor((coordinates[k] - gridMin[k]) / cellSize);
+        firstRing = max(firstRing, max(-center[k], center[k] - (gridSize[k] - 1)));
+        lastRing = max(lastRing, max(center[k], (gridSize[k] - 1) - center[k]));
+    }
+
+    for (int64_t ring = firstRing; ring <= lastRing; ring++){
+        // Every tile in this ring or further out is at least this far away
+        double ringDistance = (ring > 0) ? (double)(ring - 1) * cellSize : 0;
+        if (nearest.size() == count && nearest.front().closestDeltaE < ringDistance * boundFactor + allowedError) break;
+
+        int64_t lo[3], hi[3];
+        for (int k = 0; k < 3; k++){
+            lo[k] = max((int64_t)0, center[k] - ring);
+            hi[k] = min((int64_t)gridSize[k] - 1, center[k] + ring);
+        }
+
+        for (int64_t x = lo[0]; x <= hi[0]; x++){
+            for (int64_t y = lo[1]; y <= hi[1]; y++){
+                // Only the cells on the ring's surface are new
+                bool inside = llabs(x - center[0]) < ring && llabs(y - center[1]) < ring;
+                int64_t zStep = (inside && ring > 0) ? 2 * ring : 1;
+
+                for (int64_t z = inside ? center[2] - ring : lo[2]; z <= hi[2]; z += zStep){
+                    if (z < lo[2]) continue;
+
+                    uint64_t cell = ((uint64_t)x * gridSize[1] + y) * gridSize[2] + z;
+                    for (uint32_t t = cellStart[cell]; t < cellStart[cell + 1]; t++){
+                        int palletId = cellTiles[t];
+                        if (usable != nullptr && !usable(palletId)) continue;
+
+                        // Tiles that can't beat the worst one kept so far are skipped
+                        double worstDeltaE = (nearest.size() < count) ? Tile().closestDeltaE : nearest.front().closestDeltaE;
+                        double deltaE;
+                        if (metric == DELTAE_CIE76) deltaE = Colors::calcDeltaE(pixel, palletTiles[palletId].labColor);
+                        else {
+                            // The expensive formula only runs for tiles that could still win, 
+                            // checked with the squared Euclidean distance first
+                            double threshold = worstDeltaE - allowedError;
+                            if (threshold < 0) continue;
+
+                            const CIELABColor &tileColor = palletTiles[palletId].labColor;
+                            double deltaL = tileColor.L - pixel.L;
+                            double deltaA = tileColor.a - pixel.a;
+                            double deltaB = tileColor.b - pixel.b;
+                            double deltaAB2 = deltaA * deltaA + deltaB * deltaB;
+                            if ((deltaL * deltaL + deltaAB2) * boundFactor * boundFactor > threshold * threshold) continue;
+                            if (metric == DELTAE_CIEDE2000 && lowerBound2000(pixel, pixelChroma, palletId, deltaL, deltaAB2) > threshold * threshold) continue;
+
+                            deltaE = Colors::calcDeltaE(pixel, tileColor, metric);
+                        }
+
+                        Tile tile;
+                        tile.palletId = palletId;
+                        tile.closestDeltaE = deltaE;
+
+                        // Ties go to the lowest palletId just like the exhaustive search
+                        if (nearest.size() == count) {
+                            if (!closerTile(tile, nearest.front())) continue;
+                            pop_heap(nearest.begin(), nearest.end(), closerTile);
+                            nearest.pop_back();
+                        }
+                        nearest.push_back(tile);
+                        push_heap(nearest.begin(), nearest.end(), closerTile);
+                    }
+                }
+            }
+        }
+    }
+
+    sort_heap(nearest.begin(), nearest.end(), closerTile);
+}
+
+Tile TileMatcher::matchExhaustive(const CIELABColor &pixel){
+    if (metric == DELTAE_CIE76) return Mosaic::matchPixel(pixel, palletTiles);
+
+    Tile tile;
+    for (uint64_t i = 0; i < palletTiles.size(); i++){
+        double deltaE = Colors::calcDeltaE(pixel, palletTiles[i].labColor, metric);
+
+        if (deltaE < tile.closestDeltaE) {
+            tile.closestDeltaE = deltaE;
+            tile.palletId = i;
+        }
+    }
+
+    return tile;
+}
+
+Tile TileMatcher::match(const CIELABColor &pixel, uint64_t pixelId){
+    Tile tile = matchTile(pixel, pixelId);
+    tile.palletId = Pallet::pickVariant(palletTiles, tile.palletId, pixelId);
+
+    return tile;
+}
+
+Tile TileMatcher::matchTile(const CIELABColor &pixel, uint64_t pixelId){
+    if (clustered && !pixel.transparent) return matchClustered(pixel);
+    if (!indexed || pixel.transparent) return Mosaic::matchPixel(pixel, palletTiles);
+
+    Tile tile = matchGrid(pixel);
+
+    if (approximate && pixelId % sampleInterval == 0){
+        Tile exactTile = matchExhaustive(pixel);
+
+        lock_guard<mutex> lock(sampleMutex);
+        sampledMatches++;
+        if (exactTile.palletId != tile.palletId) {
+            double extraDeltaE = tile.closestDeltaE - exactTile.closestDeltaE;
+            mismatchedMatches++;
+            sampledExtraDeltaE += extraDeltaE;
+            maxSampledExtraDeltaE = max(maxSampledExtraDeltaE, extraDeltaE);
+        }
+    }
+
+    return tile;
+}
+
+void TileMatcher::printMismatchRate(){
+    if (!approximate) return;
+
+    lock_guard<mutex> lock(sampleMutex);
+    double rate = (sampledMatches > 0) ? (double)mismatchedMatches / (double)sampledMatches * 100 : 0;
+    double meanExtraDeltaE = (sampledMatches > 0) ? sampledExtraDeltaE / (double)sampledMatches : 0;
+
+    cout << "Approximate matching: " << rate << "% of " << sampledMatches << " sampled tiles differ from the exact match"
+        << " (mean extra deltaE " << meanExtraDeltaE << ", max " << maxSampledExtraDeltaE << ")\n";
+}
@@ -0,0 +1,105 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include "tile.h"
+#include "colors.h"
+#include "pallet.h"
+
+using namespace std;
+
+// Finds the closest pallet tile for every pixel. By default every pallet 
+// tile is checked, in approximate mode or with a perceptual metric the 
+// tiles are bucketed into a uniform grid over CIELAB space and only the 
+// cells near the pixel are searched, stopping as soon as no unsearched 
+// cell could beat the best match by more than "maxExtraDeltaE". Exact CIE76 
+// matching against a clustered pallet checks the cluster centroids first and 
+// skips every cluster whose radius can't reach closer than the best match
+class TileMatcher{
+    public:
+        // Extra deltaE an approximate match may be off from the closest tile by,
+        // negative values turn approximate matching off
+        static double maxExtraDeltaE;
+
+        // Formula matches are ranked by
+        static DeltaEMetric metric;
+
+        // Clusters of the pallet being matched against, only used when
+        // they cover exactly the tiles the matcher was made with
+        static vector<palletCluster> palletClusters;
+
+        // Every "sampleInterval"th approximate match is checked against the 
+        // exact one to measure how often they differ
+        static const uint64_t sampleInterval = 16;
+
+        uint64_t sampledMatches;
+        uint64_t mismatchedMatches;
+        double sampledExtraDeltaE;
+        double maxSampledExtraDeltaE;
+
+        // Matches against the pallet tiles only, the matched tile's 
+        // variants are picked between by the pixel's position
+        Tile match(const CIELABColor &pixel, uint64_t pixelId);
+
+        // Closest pallet tile without picking a variant for it
+        Tile matchTile(const CIELABColor &pixel, uint64_t pixelId);
+
+        // Fills "nearest" with the "count" closest pallet tiles, closest first, leaving out 
+        // tiles "usable" turns down when it's given. Only works on an indexed matcher
+        void matchNearest(const CIELABColor &pixel, unsigned int count, vector<Tile> &nearest, function<bool(int)> usable = nullptr);
+
+        // Prints how the sampled approximate matches compared to the exact ones
+        void printMismatchRate();
+
+        // "forceIndex" builds the CIELAB grid even for exact CIE76 matching
+        TileMatcher(const vector<palletTile> &palletTiles, bool forceIndex = false);
+
+    private:
+        const vector<palletTile> &palletTiles;
+        bool approximate;
+        bool indexed;
+        bool clustered;
+        mutex sampleMutex;
+
+        // Cluster members' colors laid out cluster by cluster so 
+        // every cluster is scanned as one contiguous run
+        vector<double> memberL;
+        vector<double> memberA;
+        vector<double> memberB;
+        vector<int> memberIds;
+        vector<uint32_t> clusterStart;
+
+        // Perceptual metrics are bounded from below by the Euclidean distance 
+        // scaled by factors that depend on chroma and lightness
+        vector<double> tileChroma;
+        double maxTileChroma;
+        double maxTileLightnessOffset;
+
+        double gridMin[3];
+        double cellSize;
+        int gridSize[3];
+        vector<uint32_t> cellStart;
+        vector<uint32_t> cellTiles;
+
+        void buildGrid();
+
+        Tile matchGrid(const CIELABColor &pixel);
+
+        Tile matchExhaustive(const CIELABColor &pixel);
+
+        void buildClusters();
+
+        Tile matchClustered(const CIELABColor &pixel);
+
+        // Smallest deltaE "metric" gives per unit of Euclidean distance from the pixel
+        double lowerBoundFactor(const CIELABColor &pixel, double pixelChroma);
+
+        // Cheap lower bound of the squared CIEDE2000 between the pixel and one pallet tile
+        double lowerBound2000(const CIELABColor &pixel, double pixelChroma, int palletId, double deltaL, double deltaAB2);
+};
+
+#endif
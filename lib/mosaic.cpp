@@ -1,4 +1,14 @@
 #include "mosaic.h"
+#include "imagereader.h"
+#include "renderer.h"
+#include "parallel.h"
+#include "mappedfile.h"
+#include "tilecache.h"
+#include "tilestore.h"
+#include "matcher.h"
+#include <cstring>
+#include <mutex>
+#include <atomic>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -11,11 +21,16 @@ using json = nlohmann::json;
 string Mosaic::imageName = "output.png";
 unsigned int Mosaic::imageWidth = 0;
 unsigned int Mosaic::imageHeight = 0;
-
-vector<RGBColor> Mosaic::fetchImagePixelRGBColors(string filePath_String, bool setImageResVars = false, unsigned int *minResolution_ptr = nullptr){
-    int width, height;
-    int channels; // 1 for grayscale image, 3 for rgb, 4 for rgba...
-    
+unsigned int Mosaic::sourceImageWidth = 0;
+unsigned int Mosaic::sourceImageHeight = 0;
+string Mosaic::imageFormat = "png";
+bool Mosaic::mapOutputFile = false;
+int Mosaic::pngCompressionLevel = 6;
+PNGFilter Mosaic::pngFilter = PNG_FILTER_ADAPTIVE;
+uint64_t Mosaic::tileDecodeMemory = (uint64_t)512 << 20;
+unsigned int Mosaic::outputBandBuffers = 3;
+
+uint8_t* Mosaic::loadImageData(string filePath_String, int *width, int *height, int *channels){
     // Parse the input string and turn it into a const char array because 
 	// stb_image library needs that datatype as the input file path 
     string filePath_abs;
@@ -25,23 +40,63 @@ vector<RGBColor> Mosaic::fetchImagePixelRGBColors(string filePath_String, bool s
         filePath = filePath_abs.c_str();
     } catch(exception){
         cout << "error: Couldn't find image file at path \"" << filePath_String << "\"\n";
-        vector<RGBColor> empty;
-        return empty;
+        return nullptr;
     }
 
     // Read image file data 
     uint8_t *imageData;
     try{
-        imageData = stbi_load(filePath, &width, &height, &channels, 0);
+        imageData = stbi_load(filePath, width, height, channels, 0);
     } catch(exception){
         std::cout << "error: Couldn't fetch image data for \"" << filePath_abs << "\"\n";
-        vector<RGBColor> empty;
-        return empty;
+        return nullptr;
     }
 
     if (imageData == NULL){
         std::cout << "error: Couldn't fetch image data for \"" << filePath_abs << "\"\n";
         stbi_image_free(imageData);
+        return nullptr;
+    }
+
+    return imageData;
+}
+
+void Mosaic::setImageName(string filePath_String){
+    for(int i = filePath_String.size() - 1; i >= 0; i--){
+        if (filePath_String[i] == '.') {
+            imageName = filePath_String.substr(0, i);
+            for(int j = filePath_String.size() - 1; j >= 0; j--){
+                if (filePath_String[j] == '/' || filePath_String[j] == '\\'){ 
+                    imageName = imageName.substr(j + 1);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+ImageWriter* Mosaic::createImageWriter(unsigned int threadCount){
+    ImageWriter *writer = ImageWriter::create(imageFormat);
+    if (writer == nullptr) writer = ImageWriter::create("png");
+
+    writer->threadCount = threadCount;
+
+    PNGWriter *pngWriter = dynamic_cast<PNGWriter*>(writer);
+    if (pngWriter != nullptr){
+        pngWriter->compressionLevel = pngCompressionLevel;
+        pngWriter->filter = pngFilter;
+    }
+
+    return writer;
+}
+
+vector<RGBColor> Mosaic::fetchImagePixelRGBColors(string filePath_String, bool setImageResVars, unsigned int *minResolution_ptr){
+    int width, height;
+    int channels; // 1 for grayscale image, 3 for rgb, 4 for rgba...
+
+    uint8_t *imageData = loadImageData(filePath_String, &width, &height, &channels);
+    if (imageData == nullptr){
         vector<RGBColor> nullColor;
         return nullColor;
     }
@@ -57,20 +112,10 @@ vector<RGBColor> Mosaic::fetchImagePixelRGBColors(string filePath_String, bool s
     if (setImageResVars) {
         imageWidth = width;
         imageHeight = height;
+        sourceImageWidth = width;
+        sourceImageHeight = height;
 
-        for(int i = filePath_String.size() - 1; i >= 0; i--){
-            if (filePath_String[i] == '.') {
-                imageName = filePath_String.substr(0, i);
-                for(int j = filePath_String.size() - 1; j >= 0; j--){
-                    if (filePath_String[j] == '/' || filePath_String[j] == '\\'){ 
-                        imageName = imageName.substr(j + 1);
-                        break;
-                    }
-                }
-                break;
-            }
-        }
-
+        setImageName(filePath_String);
     }
 
     // Create vector array to store the pixel RGB colors
@@ -105,146 +150,632 @@ vector<RGBColor> Mosaic::fetchImagePixelRGBColors(string filePath_String, bool s
     return pixels_RGB;
 } 
 
-vector<CIELABColor> Mosaic::fetchImagePixelCIELABColors(string filePath_String = "input.png"){
-    // Fetch the RGB colors vector so it can be 
-    // converted to and returned as a CIELAB colors vector
+vector<uint8_t> Mosaic::fetchPalletTilePixels(const Pallet &pallet, int palletId, MemoryBudget *decodeBudget, unsigned int tileSize){
+    const unsigned int R = (tileSize > 0) ? tileSize : pallet.minResolution;
+    string tileImgFilePath = pallet.palletTilesDirPath + pallet.fetchTile(palletId).name + pallet.fetchTile(palletId).fileType;
+
+    vector<uint8_t> pixels;
+    if (!TileCache::load(tileImgFilePath, R, pixels)) return pixels;
 
-    vector<RGBColor> pixels_RGB = fetchImagePixelRGBColors(filePath_String, true);
+    int width, height;
+    int channels;
+
+    // The header is enough to know how big the decoded image is going to be
+    uint64_t decodeBytes = 0;
+    if (decodeBudget != nullptr && stbi_info(tileImgFilePath.c_str(), &width, &height, &channels))
+        decodeBytes = (uint64_t)width * height * channels;
+    if (decodeBytes > 0) decodeBudget->acquire(decodeBytes);
+
+    uint8_t *imageData = loadImageData(tileImgFilePath, &width, &height, &channels);
+    if (imageData == nullptr) {
+        if (decodeBytes > 0) decodeBudget->release(decodeBytes);
+        return pixels;
+    }
 
-    // Convert RGB pixel array to CIELAB pixel color array
-    vector<CIELABColor> pixels_CIELAB;
-    pixels_CIELAB.resize(pixels_RGB.size());
-    for (int i = 0; i < pixels_RGB.size(); i++){
-        pixels_CIELAB[i] = Colors::rgbToCIELAB(pixels_RGB[i]);
+    // Tiles bigger than "R" are center cropped to a square and box-filtered 
+    // down to "R x R", smaller ones are scaled up by repeating pixels
+    const unsigned int side = min(width, height);
+    const unsigned int offsetX = (width - side) / 2;
+    const unsigned int offsetY = (height - side) / 2;
+
+    pixels.resize((uint64_t)R * R * 4);
+    for (unsigned int y = 0; y < R; y++){
+        unsigned int y0 = offsetY + (uint64_t)y * side / R;
+        unsigned int y1 = max(y0 + 1, offsetY + (unsigned int)((uint64_t)(y + 1) * side / R));
+        for (unsigned int x = 0; x < R; x++){
+            unsigned int x0 = offsetX + (uint64_t)x * side / R;
+            unsigned int x1 = max(x0 + 1, offsetX + (unsigned int)((uint64_t)(x + 1) * side / R));
+
+            // Color is weighted by alpha so transparent pixels don't bleed into it
+            uint64_t sum[4] = {0, 0, 0, 0};
+            for (unsigned int sy = y0; sy < y1; sy++){
+                for (unsigned int sx = x0; sx < x1; sx++){
+                    const uint8_t *pixel = imageData + ((uint64_t)sy * width + sx) * channels;
+                    uint8_t r = pixel[0];
+                    uint8_t g = (channels < 3) ? pixel[0] : pixel[1];
+                    uint8_t b = (channels < 3) ? pixel[0] : pixel[2];
+                    uint8_t a = (channels == 2 || channels == 4) ? pixel[channels - 1] : 255;
+
+                    sum[0] += r * a;
+                    sum[1] += g * a;
+                    sum[2] += b * a;
+                    sum[3] += a;
+                }
+            }
+
+            uint64_t count = (uint64_t)(x1 - x0) * (y1 - y0);
+            uint8_t *out = &pixels[((uint64_t)y * R + x) * 4];
+            for (int c = 0; c < 3; c++) out[c] = (sum[3] > 0) ? (sum[c] + sum[3] / 2) / sum[3] : 0;
+            out[3] = (sum[3] + count / 2) / count;
+        }
+    }
+
+    stbi_image_free(imageData);
+    if (decodeBytes > 0) decodeBudget->release(decodeBytes);
+
+    TileCache::store(tileImgFilePath, R, pixels);
+    return pixels;
+}
+
+LabPlanes Mosaic::fetchImagePixelCIELABColors(string filePath_String, unsigned int gridWidth, unsigned int gridHeight){
+    LabPlanes pixels_CIELAB;
+
+    // Without a target grid every source pixel becomes one tile, so fetch 
+    // the RGB colors vector so it can be converted to and returned 
+    // as CIELAB color planes
+    if (gridWidth == 0 && gridHeight == 0){
+        vector<RGBColor> pixels_RGB = fetchImagePixelRGBColors(filePath_String, true);
+
+        // Convert RGB pixel array to CIELAB pixel color planes
+        pixels_CIELAB.resize(pixels_RGB.size());
+        for (uint64_t i = 0; i < pixels_RGB.size(); i++){
+            pixels_CIELAB.set(i, Colors::rgbToCIELAB(pixels_RGB[i]));
+        }
+
+        return pixels_CIELAB;
+    }
+
+    bool result = streamImageCIELABRows(filePath_String, gridWidth, gridHeight, 64, 
+        [&](unsigned int row, vector<CIELABColor> &rowPixels){
+            if (pixels_CIELAB.size() < 1) pixels_CIELAB.resize((uint64_t)imageWidth * imageHeight);
+            for (unsigned int x = 0; x < rowPixels.size(); x++) pixels_CIELAB.set((uint64_t)row * imageWidth + x, rowPixels[x]);
+        }
+    );
+
+    if (result) {
+        LabPlanes empty;
+        return empty;
     }
 
     return pixels_CIELAB;
 }
 
-vector<Tile> Mosaic::matchPixelsAndPalletTiles(vector<CIELABColor> pixels, const vector<palletTile> palletTiles, bool silentMode = false){
-    vector<Tile> tiles;
-    tiles.resize(pixels.size());
-
-    // For each pixel (j) create a new tile, and
-    // search through every tile (i) in pallet to find
-    // the closest match (smallest deltaE)
-    for(int j = 0; j < pixels.size(); j++){
-        Tile tile;
-        tile.pixelId = j;
-
-        // This is for if the main image pixel is (50% >= transparent)
-        if (pixels[j].transparent) {
-            tile.palletId = -1;
-            tiles[j] = tile;
-            continue;
+// No grid means one tile per source pixel, if only one grid 
+// dimension was given derive the other one from the input 
+// image's aspect ratio
+static void fitGrid(unsigned int width, unsigned int height, unsigned int &gridWidth, unsigned int &gridHeight){
+    if (gridWidth == 0 && gridHeight == 0){
+        gridWidth = width;
+        gridHeight = height;
+    }
+    if (gridHeight == 0) gridHeight = (unsigned int)max(1.0, round((double)gridWidth * height / width));
+    if (gridWidth == 0) gridWidth = (unsigned int)max(1.0, round((double)gridHeight * width / height));
+
+    // The grid can only shrink the image, a tile per source pixel is the upper limit
+    if (gridWidth > width) gridWidth = width;
+    if (gridHeight > height) gridHeight = height;
+}
+
+// Box-filters source rows into one row of grid cells
+struct CellRowFilter{
+    unsigned int width;
+    unsigned int channels;
+    unsigned int gridWidth;
+    const double *linearLUT;
+    const unsigned int *columnCell;
+
+    // Linear R, G, B sums of the opaque pixels plus the opaque/total pixel counts of each box
+    vector<double> sums;
+    vector<uint64_t> opaqueCounts;
+    vector<uint64_t> totalCounts;
+
+    CellRowFilter(unsigned int width, unsigned int channels, unsigned int gridWidth, const double *linearLUT, const unsigned int *columnCell){
+        this->width = width;
+        this->channels = channels;
+        this->gridWidth = gridWidth;
+        this->linearLUT = linearLUT;
+        this->columnCell = columnCell;
+        sums.resize(gridWidth * 3);
+        opaqueCounts.resize(gridWidth);
+        totalCounts.resize(gridWidth);
+    }
+
+    void addRow(const uint8_t *row){
+        for (unsigned int x = 0; x < width; x++){
+            const uint8_t *pixel = row + (uint64_t)x * channels;
+            unsigned int cell = columnCell[x];
+            totalCounts[cell]++;
+
+            // Pixels that are (50% >= transparent) don't contribute color
+            if ((channels == 2 || channels == 4) && pixel[channels - 1] < 128) continue;
+
+            opaqueCounts[cell]++;
+            if (channels < 3){
+                double gray = linearLUT[pixel[0]];
+                sums[cell * 3] += gray;
+                sums[cell * 3 + 1] += gray;
+                sums[cell * 3 + 2] += gray;
+            } else {
+                sums[cell * 3] += linearLUT[pixel[0]];
+                sums[cell * 3 + 1] += linearLUT[pixel[1]];
+                sums[cell * 3 + 2] += linearLUT[pixel[2]];
+            }
         }
+    }
 
-        for(int i = 0; i < palletTiles.size(); i++){
-            palletTile palletTile = palletTiles[i];
+    // Converts the finished row of cells and clears the sums for the next one
+    void finish(vector<CIELABColor> &rowPixels){
+        rowPixels.resize(gridWidth);
+        for (unsigned int cx = 0; cx < gridWidth; cx++){
+            // A grid cell is transparent when most of its box is transparent
+            bool transparent = opaqueCounts[cx] * 2 < totalCounts[cx] || opaqueCounts[cx] == 0;
+            double count = (opaqueCounts[cx] > 0) ? (double)opaqueCounts[cx] : 1.0;
+
+            CIELABColor color = Colors::linearRGBToCIELAB(
+                sums[cx * 3] / count, sums[cx * 3 + 1] / count, sums[cx * 3 + 2] / count, transparent
+            );
+
+            // Rounded to float here and only here, so every path matches exactly 
+            // the colors LabPlanes holds no matter if it goes through them
+            rowPixels[cx] = CIELABColor((float)color.L, (float)color.a, (float)color.b, transparent);
+        }
 
-            double deltaE = Colors::calcDeltaE(pixels[j], palletTile.labColor);
+        fill(sums.begin(), sums.end(), 0.0);
+        fill(opaqueCounts.begin(), opaqueCounts.end(), 0);
+        fill(totalCounts.begin(), totalCounts.end(), 0);
+    }
+};
+
+bool Mosaic::streamImageCIELABRows(string filePath_String, unsigned int gridWidth, unsigned int gridHeight, unsigned int bandHeight, function<void(unsigned int, vector<CIELABColor>&)> rowCallback){
+    ImageReader reader;
+    if (reader.open(filePath_String)) return 1;
+
+    const unsigned int width = reader.width;
+    const unsigned int height = reader.height;
+    const unsigned int channels = reader.channels;
+
+    fitGrid(width, height, gridWidth, gridHeight);
+    imageWidth = gridWidth;
+    imageHeight = gridHeight;
+    sourceImageWidth = width;
+    sourceImageHeight = height;
+    setImageName(filePath_String);
+
+    if (bandHeight < 1) bandHeight = 1;
+
+    // sRGB -> linear lookup table so every source pixel costs
+    // three loads instead of three pow() calls
+    double linearLUT[256];
+    for (int i = 0; i < 256; i++) linearLUT[i] = Colors::srgbToLinear(i);
+
+    // Which grid column every source column falls into
+    vector<unsigned int> columnCell;
+    columnCell.resize(width);
+    for (unsigned int x = 0; x < width; x++) columnCell[x] = (uint64_t)x * gridWidth / width;
+
+    // Only one band of source rows is held in memory at a time
+    vector<uint8_t> band;
+    band.resize((uint64_t)bandHeight * width * channels);
+
+    CellRowFilter filter(width, channels, gridWidth, linearLUT, columnCell.data());
+    vector<CIELABColor> rowPixels;
+
+    unsigned int cy = 0;
+    unsigned int cellRowEnd = (uint64_t)height / gridHeight;
+    unsigned int y = 0;
+    while (y < height){
+        unsigned int rowsRead = reader.readRows(band.data(), bandHeight);
+        if (rowsRead < 1 || reader.truncated){
+            cout << "error: Unexpected end of image data in \"" << filePath_String << "\"\n";
+            return 1;
+        }
 
-            if (deltaE < tile.closestDeltaE) {
-                tile.closestDeltaE = deltaE;
-                tile.palletId = i;
-            };
+        // Box-filter the source rows of this band into the current row of grid cells
+        for (unsigned int by = 0; by < rowsRead; by++, y++){
+            filter.addRow(band.data() + (uint64_t)by * width * channels);
+
+            if (y + 1 < cellRowEnd) continue;
+
+            // Every source row of this grid row was read, so convert it and hand it over
+            filter.finish(rowPixels);
+            rowCallback(cy, rowPixels);
+
+            cy++;
+            cellRowEnd = (uint64_t)(cy + 1) * height / gridHeight;
         }
+    }
 
-        if (!silentMode) cout << "Progress: "
-            << (int)((float)((j+1) * palletTiles.size()) / (float)(palletTiles.size() * pixels.size()) * 100) << "%"
-            << " (" << (j+1) * palletTiles.size() << " / " << (palletTiles.size() * pixels.size()) << ") pixel/tile matches calculated\n";
+    return 0;
+}
+
+vector<Tile> Mosaic::matchImageFused(string filePath_String, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode, function<void(unsigned int, const Tile*)> rowCallback){
+    vector<Tile> tiles;
 
-        tiles[j] = tile;
+    ImageReader reader;
+    if (reader.open(filePath_String)) return tiles;
+
+    const unsigned int width = reader.width;
+    const unsigned int height = reader.height;
+    const unsigned int channels = reader.channels;
+
+    fitGrid(width, height, gridWidth, gridHeight);
+    imageWidth = gridWidth;
+    imageHeight = gridHeight;
+    sourceImageWidth = width;
+    sourceImageHeight = height;
+    setImageName(filePath_String);
+
+    // Images stb_image decodes are used in place, streamed formats are read in once
+    vector<uint8_t> decodedRows;
+    const uint8_t *imageData = reader.decodedPixels();
+    if (imageData == nullptr){
+        decodedRows.resize((uint64_t)width * height * channels);
+        if (reader.readRows(decodedRows.data(), height) < height){
+            cout << "error: Unexpected end of image data in \"" << filePath_String << "\"\n";
+            return tiles;
+        }
+        imageData = decodedRows.data();
+    }
+
+    double linearLUT[256];
+    for (int i = 0; i < 256; i++) linearLUT[i] = Colors::srgbToLinear(i);
+
+    vector<unsigned int> columnCell;
+    columnCell.resize(width);
+    for (unsigned int x = 0; x < width; x++) columnCell[x] = (uint64_t)x * gridWidth / width;
+
+    tiles.resize((uint64_t)gridWidth * gridHeight);
+    TileMatcher matcher(palletTiles);
+    mutex progressMutex;
+    atomic<unsigned int> rowsMatched(0);
+
+    // Every grid row's source rows are filtered, converted and matched 
+    // while they're still in cache, only the matched tiles are written out
+    Parallel::forEach(gridHeight, threadCount, [&](uint64_t cy){
+        CellRowFilter filter(width, channels, gridWidth, linearLUT, columnCell.data());
+        vector<CIELABColor> rowPixels;
+
+        unsigned int rowStart = (uint64_t)cy * height / gridHeight;
+        unsigned int rowEnd = (uint64_t)(cy + 1) * height / gridHeight;
+        for (unsigned int y = rowStart; y < rowEnd; y++) filter.addRow(imageData + (uint64_t)y * width * channels);
+        filter.finish(rowPixels);
+
+        for (unsigned int x = 0; x < gridWidth; x++){
+            uint64_t pixelId = cy * gridWidth + x;
+            tiles[pixelId] = matcher.match(rowPixels[x], pixelId);
+            tiles[pixelId].pixelId = pixelId;
+        }
+        if (rowCallback) rowCallback(cy, tiles.data() + cy * gridWidth);
+
+        unsigned int row = ++rowsMatched;
+        if (silentMode) return;
+        lock_guard<mutex> lock(progressMutex);
+        cout << "Progress: "
+            << (int)((float)row / (float)gridHeight * 100) << "%"
+            << " (" << row << " / " << gridHeight << ") rows matched\n";
+    });
+
+    matcher.printMismatchRate();
+    return tiles;
+}
+
+vector<Tile> Mosaic::matchImageStreaming(string filePath_String, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int bandHeight, bool silentMode){
+    vector<Tile> tiles;
+    TileMatcher matcher(palletTiles);
+
+    // Every finished row of grid cells is matched right away and then
+    // dropped, so only the band, one row of cells and the tiles are kept
+    bool result = streamImageCIELABRows(filePath_String, gridWidth, gridHeight, bandHeight, 
+        [&](unsigned int row, vector<CIELABColor> &rowPixels){
+            if (tiles.size() < 1) tiles.resize((uint64_t)imageWidth * imageHeight);
+
+            for (unsigned int x = 0; x < rowPixels.size(); x++){
+                unsigned int pixelId = row * imageWidth + x;
+                tiles[pixelId] = matcher.match(rowPixels[x], pixelId);
+                tiles[pixelId].pixelId = pixelId;
+            }
+
+            if (!silentMode) cout << "Progress: "
+                << (int)((float)(row + 1) / (float)imageHeight * 100) << "%"
+                << " (" << row + 1 << " / " << imageHeight << ") rows matched\n";
+        }
+    );
+
+    if (result) {
+        vector<Tile> empty;
+        return empty;
     }
 
+    matcher.printMismatchRate();
     return tiles;
 }
 
-bool Mosaic::generateMosaicImageFile(vector<Tile> tiles, Pallet pallet, bool silentMode = false){
+Tile Mosaic::matchPixel(const CIELABColor &pixel, const vector<palletTile> &palletTiles){
+    Tile tile;
+
+    // This is for if the main image pixel is (50% >= transparent)
+    if (pixel.transparent) {
+        tile.palletId = -1;
+        return tile;
+    }
+
+    for(int i = 0; i < palletTiles.size(); i++){
+        double deltaE = Colors::calcDeltaE(pixel, palletTiles[i].labColor);
+
+        if (deltaE < tile.closestDeltaE) {
+            tile.closestDeltaE = deltaE;
+            tile.palletId = i;
+        };
+    }
+
+    return tile;
+}
+
+bool Mosaic::generateMosaicImageFile(vector<Tile> tiles, Pallet pallet, bool silentMode = false, unsigned int threadCount = 1){
     const unsigned int channels = 4;
     const unsigned int palletTileWidth = pallet.minResolution;
     const unsigned int palletTileHeight = pallet.minResolution;
-    const unsigned int width = imageWidth * palletTileWidth;
-    const unsigned int height = imageHeight * palletTileHeight;
+    const uint64_t width = (uint64_t)imageWidth * palletTileWidth;
+    const uint64_t height = (uint64_t)imageHeight * palletTileHeight;
+    const string outputFilePath = imageName + "_mosaic." + imageFormat;
+
+    // Raw RGBA and PAM files are just a header followed by the pixels, 
+    // so they can be composed straight into the memory mapped file
+    const bool mapped = mapOutputFile && (imageFormat == "rgba" || imageFormat == "pam");
+    MappedFile outputFile;
     
+    // Decode every pallet tile the mosaic uses once, up front and in parallel, 
+    // so composing a tile is just a pointer load and a row copy. Adaptive 
+    // mosaics get a store for every block size, with tiles scaled to the block
+    vector<bool> usedBlockSizes;
+    usedBlockSizes.resize(2, false);
+    for (uint64_t i = 0; i < tiles.size(); i++){
+        if (tiles[i].blockSize >= usedBlockSizes.size()) usedBlockSizes.resize(tiles[i].blockSize + 1, false);
+        usedBlockSizes[tiles[i].blockSize] = true;
+    }
+
+    vector<unique_ptr<TileStore>> tileStores;
+    tileStores.resize(usedBlockSizes.size());
+    for (unsigned int blockSize = 1; blockSize < usedBlockSizes.size(); blockSize++){
+        if (!usedBlockSizes[blockSize]) continue;
+        tileStores[blockSize].reset(new TileStore());
+        if (tileStores[blockSize]->load(tiles, pallet, threadCount, blockSize)) return 1;
+    }
+
     // Every pixel has "channels" channels
     // Every tile has "palletTileWidth * palletTileHeight" pixels
     // The image is made up of "width * height" tiles
-    uint8_t* imageData = new uint8_t[width * height * channels];
+    // A band is one row of tiles, "width * palletTileHeight" pixels
+    const uint64_t bandBytes = width * palletTileHeight * channels;
+    uint8_t* imageData = nullptr;
+    if (mapped){
+        string header = (imageFormat == "pam") ? PNMWriter::header(true, width, height, channels) : "";
+        if (imageFormat == "rgba" && RawWriter::writeDescriptor(outputFilePath, width, height, channels)) return 1;
+
+        if (outputFile.create(outputFilePath, header.size() + width * height * channels)) {
+            cout << "error: Unable to map output file \"" << outputFilePath << "\"\n";
+            return 1;
+        }
+        memcpy(outputFile.data, header.data(), header.size());
+        imageData = outputFile.data + header.size();
+    }
+
+    // Otherwise bands are composed into a small ring while the encoder 
+    // thread is compressing and writing the ones before them
+    BandRing bands(mapped ? 0 : bandBytes, outputBandBuffers);
+    bool encodeResult = false;
+    thread encoder;
+    if (!mapped) encoder = thread([&](){
+        ImageWriter *writer = createImageWriter(threadCount);
+        encodeResult = writer->open(outputFilePath, width, height, channels);
+
+        for (uint64_t j = 0; j < imageHeight && !encodeResult; j++) {
+            const uint8_t *band = bands.next(j);
+            encodeResult = band == nullptr || writer->writeRows(band, palletTileHeight);
+            bands.release(j);
+        }
+
+        encodeResult = writer->close() || encodeResult;
+        delete writer;
 
-    // This is used so the loop doesn't have to load the same 
-    // pallet tile image color values every time it want's to 
-    // use the same tile
-    map<int, vector<RGBColor>> loadedPalletTiles;
+        // The compositor mustn't wait on a band that's never going to be written
+        if (encodeResult) bands.stop();
+    });
 
-    // Load default transparent tile as index "-1"
-    vector<RGBColor> transparentTile;
-    transparentTile.resize(palletTileWidth * palletTileHeight);
-    for (int i = 0; i < palletTileWidth * palletTileHeight; i++)
-        transparentTile[i] = RGBColor(0, 0, 0, 0);
-    loadedPalletTiles.insert({-1, transparentTile});
-    transparentTile.clear();
+    const uint64_t tileRowBytes = (uint64_t)palletTileWidth * channels;
 
     // For every i,j tile with index
-    for (int j = 0; j < imageHeight; j++) {
-        for (int i = 0; i < imageWidth; i++) {
-            unsigned int tileIndex = (j * imageWidth + i);
+    for (uint64_t j = 0; j < imageHeight; j++) {
+        uint8_t *bandData = mapped ? imageData + j * bandBytes : bands.acquire(j);
+        if (bandData == nullptr) break;
+
+        for (uint64_t i = 0; i < imageWidth; i++) {
+            uint64_t tileIndex = (j * imageWidth + i);
+            const unsigned int blockSize = tiles[tileIndex].blockSize;
+            const uint64_t blockRowBytes = blockSize * tileRowBytes;
+
+            // Fetch the RGBA pixels of the current tile, for a block that's 
+            // the part of the scaled tile that falls in this cell
+            const uint8_t* tilePixels = tileStores[blockSize]->pixels(tiles[tileIndex].palletId)
+                + (j % blockSize) * palletTileHeight * blockRowBytes + (i % blockSize) * tileRowBytes;
+
+            // For each y row of pallet image
+            for (uint64_t y = 0; y < palletTileHeight; y++) {
+                // Xg = X + (i * W)
+                // Yb = y, the band starts at the tile row
+                // Wt = w * W
+                // INDEXxy = Xg + (Yb * Wt)
+                uint64_t pixelIndex = ((i * palletTileWidth) + (y * width)) * channels; 
+
+                memcpy(bandData + pixelIndex, tilePixels + y * blockRowBytes, tileRowBytes);
+            }
 
-            // Fetch the RGB color pixels of the current tile
-            Tile tile = tiles[tileIndex];
+            if (!silentMode) cout << "Progress: "
+                << (int)(((float)(tileIndex + 1) / (float)((uint64_t)imageWidth * imageHeight)) * 100) << "% ("
+                << tileIndex + 1 << " / " << (uint64_t)imageWidth * imageHeight << ") tiles generated\n"; 
+        }
 
-            vector<RGBColor> tilePixels_RGB;
+        if (!mapped) bands.publish(j);
+    }
 
-            // Check to see if pallet tile can be reused
-            if (loadedPalletTiles.count(tile.palletId) > 0){
-                tilePixels_RGB = loadedPalletTiles[tile.palletId];
-            }
-            // If not, load it in and add it to the list of loaded tiles
-            else{
-                string tileImgFilePath = pallet.palletTilesDirPath + pallet.tiles[tile.palletId].name + pallet.tiles[tile.palletId].fileType;
-                tilePixels_RGB = fetchImagePixelRGBColors(tileImgFilePath);
-                if (tilePixels_RGB.size() < 1) {
-                    cout << "error: Unable to load pallet image file";
-                    return 1;
-                }
+    // The mapped file already is the finished output, unmapping it hands it to the OS
+    if (mapped){
+        cout << "\nFlushing mapped image file...\n";
+        return outputFile.close();
+    }
 
-                loadedPalletTiles.insert({tile.palletId, tilePixels_RGB}); 
-            }
+    cout << "\nWriting image data to file...\n";
+    encoder.join();
+    cout << "Output bands: compositor stalled for " << (double)bands.composeStallTime / 1000000 
+        << " s, encoder stalled for " << (double)bands.writeStallTime / 1000000 << " s\n";
 
-            // For each x,y pixel of pallet image
-            for (int y = 0; y < palletTileHeight; y++) {
-                for (int x = 0; x < palletTileWidth; x++) {
-                    // Xg = X + (i * W)
-                    // Yg = Y + (j * H)
-                    // Wt = w * W
-                    // INDEXxy = Xg + (Yg * Wt)
-                    uint64_t pixelIndex = ((x + (i * palletTileWidth)) + ((y + (j * palletTileHeight)) * width)) * channels; 
-
-                    imageData[pixelIndex] = (uint8_t)tilePixels_RGB[x + (y * palletTileWidth)].r;
-                    imageData[pixelIndex + 1] = (uint8_t)tilePixels_RGB[x + (y * palletTileWidth)].g;
-                    imageData[pixelIndex + 2] = (uint8_t)tilePixels_RGB[x + (y * palletTileWidth)].b;
-                    imageData[pixelIndex + 3] = (uint8_t)tilePixels_RGB[x + (y * palletTileWidth)].a;
-                }
-            }
+    return encodeResult;
+} 
 
-            if (!silentMode) cout << "Progress: "
-                << (int)(((float)(tileIndex + 1) / (float)(imageWidth * imageHeight)) * 100) << "% ("
-                << tileIndex + 1 << " / " << imageWidth * imageHeight << ") tiles generated\n"; 
+bool Mosaic::generateMosaicDeepZoom(const vector<Tile> &tiles, const Pallet &pallet, unsigned int tileSize, unsigned int threadCount, bool silentMode){
+    // Every tile is going to be needed by some pyramid tile, so decode them all up front
+    MosaicRenderer renderer(tiles, pallet, imageWidth, imageHeight);
+    if (renderer.loadTiles(threadCount)) return 1;
+
+    const uint64_t width = renderer.width;
+    const uint64_t height = renderer.height;
+
+    // The top level is the full resolution mosaic and 
+    // every level below it is half the size of the one above
+    unsigned int maxLevel = 0;
+    while (((uint64_t)1 << maxLevel) < max(width, height)) maxLevel++;
+
+    const string basePath = imageName + "_mosaic";
+    const string filesPath = basePath + "_files/";
+
+    // Deep Zoom descriptor
+    ofstream dzi_stream(basePath + ".dzi");
+    if (!dzi_stream.is_open()) return 1;
+    dzi_stream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"0\" TileSize=\"" << tileSize << "\">\n"
+        << "    <Size Width=\"" << width << "\" Height=\"" << height << "\"/>\n"
+        << "</Image>\n";
+    dzi_stream.close();
+
+    // Every pyramid tile across all the levels is one job
+    vector<uint64_t> levelFirstJob;
+    uint64_t jobCount = 0;
+    for (unsigned int level = 0; level <= maxLevel; level++){
+        uint64_t downscale = (uint64_t)1 << (maxLevel - level);
+        uint64_t levelWidth = (width + downscale - 1) / downscale;
+        uint64_t levelHeight = (height + downscale - 1) / downscale;
+
+        levelFirstJob.push_back(jobCount);
+        jobCount += ((levelWidth + tileSize - 1) / tileSize) * ((levelHeight + tileSize - 1) / tileSize);
+
+        try{
+            create_directories(path(filesPath + to_string(level)));
+        } catch(const exception&){
+            cout << "error: Unable to create directory \"" << filesPath + to_string(level) << "\"\n";
+            return 1;
         }
     }
 
-    // Free the memory because the pallet tiles aren't used after this point
-    loadedPalletTiles.clear();
+    mutex cout_mutex;
+    atomic<uint64_t> jobsDone(0);
+    atomic<bool> failed(false);
+
+    Parallel::forEach(jobCount, threadCount, [&](uint64_t job){
+        unsigned int level = maxLevel;
+        while (levelFirstJob[level] > job) level--;
+
+        uint64_t downscale = (uint64_t)1 << (maxLevel - level);
+        uint64_t levelWidth = (width + downscale - 1) / downscale;
+        uint64_t levelHeight = (height + downscale - 1) / downscale;
+        uint64_t columns = (levelWidth + tileSize - 1) / tileSize;
+        uint64_t column = (job - levelFirstJob[level]) % columns;
+        uint64_t row = (job - levelFirstJob[level]) / columns;
+
+        // Edge tiles are cropped to the level's size
+        unsigned int regionWidth = min((uint64_t)tileSize, levelWidth - column * tileSize);
+        unsigned int regionHeight = min((uint64_t)tileSize, levelHeight - row * tileSize);
+
+        vector<uint8_t> imageData;
+        imageData.resize((uint64_t)regionWidth * regionHeight * 4);
+        if (renderer.renderRegion(column * tileSize, row * tileSize, regionWidth, regionHeight, 1.0 / downscale, imageData.data())) failed = true;
+
+        string tilePath = filesPath + to_string(level) + "/" + to_string(column) + "_" + to_string(row) + ".png";
+        // Pyramid tiles are already encoded in parallel, so each one gets a single thread
+        if (PNGWriter::write(tilePath, regionWidth, regionHeight, 4, imageData.data(), pngCompressionLevel, pngFilter, 1)) failed = true;
+
+        uint64_t done = ++jobsDone;
+        if (!silentMode) {
+            lock_guard<mutex> lock(cout_mutex);
+            cout << "Progress: "
+                << (int)(((float)done / (float)jobCount) * 100) << "% ("
+                << done << " / " << jobCount << ") pyramid tiles generated\n"; 
+        }
+    });
 
-    cout << "\nWriting image data to file...\n";
-    stbi_write_png((imageName + "_mosaic.png").c_str(), width, height, channels, imageData, width * channels);
-    
-    // Free the image data pointer to avoid memory leak
-    delete [] imageData;
-    imageData = nullptr;
+    if (failed) {
+        cout << "error: Unable to write pyramid tile files\n";
+        return 1;
+    }
 
     return 0;
-} 
+}
+
+vector<uint8_t> Mosaic::renderMosaicRegion(const vector<Tile> &tiles, const Pallet &pallet, uint64_t x, uint64_t y, unsigned int regionWidth, unsigned int regionHeight, double scale, unsigned int threadCount){
+    vector<uint8_t> imageData;
+    imageData.resize((uint64_t)regionWidth * regionHeight * 4);
+
+    // Tiles are decoded lazily by the renderer, so only 
+    // the ones inside the region are ever loaded
+    MosaicRenderer renderer(tiles, pallet, imageWidth, imageHeight);
+
+    // Split the region into bands of rows so they can be rendered in parallel
+    const unsigned int bandHeight = 64;
+    atomic<bool> failed(false);
+    Parallel::forEach((regionHeight + bandHeight - 1) / bandHeight, threadCount, [&](uint64_t band){
+        unsigned int bandY = band * bandHeight;
+        unsigned int rows = min(bandHeight, regionHeight - bandY);
+        uint8_t *bandData = imageData.data() + (uint64_t)bandY * regionWidth * 4;
+
+        if (renderer.renderRegion(x, y + bandY, regionWidth, rows, scale, bandData)) failed = true;
+    });
+
+    if (failed) {
+        vector<uint8_t> empty;
+        return empty;
+    }
+
+    return imageData;
+}
+
+bool Mosaic::generateMosaicRegionFile(const vector<Tile> &tiles, const Pallet &pallet, uint64_t x, uint64_t y, unsigned int regionWidth, unsigned int regionHeight, double scale, unsigned int threadCount){
+    // A 0 sized region means everything from "(x, y)" to the edge of the scaled mosaic
+    uint64_t scaledWidth = ceil((double)imageWidth * pallet.minResolution * scale);
+    uint64_t scaledHeight = ceil((double)imageHeight * pallet.minResolution * scale);
+    if (x >= scaledWidth || y >= scaledHeight) {
+        cout << "error: Region is outside of the " << scaledWidth << "x" << scaledHeight << " mosaic\n";
+        return 1;
+    }
+    if (regionWidth == 0) regionWidth = scaledWidth - x;
+    if (regionHeight == 0) regionHeight = scaledHeight - y;
+
+    vector<uint8_t> imageData = renderMosaicRegion(tiles, pallet, x, y, regionWidth, regionHeight, scale, threadCount);
+    if (imageData.size() < 1) return 1;
+
+    cout << "\nWriting " << regionWidth << "x" << regionHeight << " region to file...\n";
+    if (PNGWriter::write(imageName + "_mosaic_region.png", regionWidth, regionHeight, 4, imageData.data(), pngCompressionLevel, pngFilter, threadCount)) return 1;
+
+    return 0;
+}
 
 void Mosaic::generateMosaicJSONFile(vector<Tile> tiles, Pallet pallet, string palletFilePath, uint64_t calculationTime, uint64_t generationTime){
     string jsonText = "{\"width\": " + to_string(imageWidth) + ", "
@@ -257,11 +788,12 @@ void Mosaic::generateMosaicJSONFile(vector<Tile> tiles, Pallet pallet, string pa
     // For every i,j pixel of image
     for (int j = 0; j < imageHeight; j++) {
         for (int i = 0; i < imageWidth; i++) {
-            unsigned int tileIndex = (j * imageWidth + i);
+            uint64_t tileIndex = ((uint64_t)j * imageWidth + i);
 
             jsonText += "{\"palletTileId\": " + to_string(tiles[tileIndex].palletId) + ", "
                 + "\"palletTileName\": \""
-                + ((tiles[tileIndex].palletId >= 0) ? pallet.tiles[tiles[tileIndex].palletId].name : "none") + "\"}";
+                + ((tiles[tileIndex].palletId >= 0) ? pallet.fetchTile(tiles[tileIndex].palletId).name : "none") + "\""
+                + ((tiles[tileIndex].blockSize > 1) ? ", \"blockSize\": " + to_string(tiles[tileIndex].blockSize) : "") + "}";
             if (j + 1 < imageHeight || i + 1  < imageWidth) jsonText += ", ";
         }
     }
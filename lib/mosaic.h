@@ -8,9 +8,14 @@
 #include <filesystem>
 #include <map>
 #include <fstream> 
+#include <algorithm>
+#include <functional>
 #include "tile.h"
 #include "colors.h"
 #include "pallet.h"
+#include "pngwriter.h"
+#include "parallel.h"
+#include "labplanes.h"
 
 using namespace std;
 
@@ -19,14 +24,73 @@ class Mosaic{
         static string imageName;
         static unsigned int imageWidth;
         static unsigned int imageHeight;
+        static unsigned int sourceImageWidth;
+        static unsigned int sourceImageHeight;
 
-        static vector<RGBColor> fetchImagePixelRGBColors(string filePath_String, bool setImageResVars, unsigned int *minResolution);
+        // Format the mosaic image is written in, "png", "qoi", "ppm", "pam" or "rgba"
+        static string imageFormat;
 
-        static vector<CIELABColor> fetchImagePixelCIELABColors(string filePath_String);
+        // Compose "rgba" and "pam" images straight into a memory mapped output file
+        static bool mapOutputFile;
+
+        // PNG encoder settings used for every PNG the mosaic is written to
+        static int pngCompressionLevel;
+        static PNGFilter pngFilter;
+
+        // Tile rows of composed output held for the encoder thread at once, 2 for double buffering
+        static unsigned int outputBandBuffers;
+
+        // Most bytes of source pallet images being decoded at once while prefetching tiles
+        static uint64_t tileDecodeMemory;
+
+        // Creates the encoder for "imageFormat" with the current settings
+        static ImageWriter* createImageWriter(unsigned int threadCount);
+
+        static uint8_t* loadImageData(string filePath_String, int *width, int *height, int *channels);
+
+        static void setImageName(string filePath_String);
+
+        static vector<RGBColor> fetchImagePixelRGBColors(string filePath_String, bool setImageResVars = false, unsigned int *minResolution = nullptr);
+
+        // Fetches the RGBA pixels of a pallet tile scaled to the pallet's tile size,
+        // through the on-disk tile cache when it's enabled. Empty on error. 
+        // Full size decodes are held against "decodeBudget" when one is given. 
+        // A "tileSize" other than 0 scales the tile to that size instead
+        static vector<uint8_t> fetchPalletTilePixels(const Pallet &pallet, int palletId, MemoryBudget *decodeBudget = nullptr, unsigned int tileSize = 0);
+
+        // When a grid size is given the input is box-filtered down to 
+        // "gridWidth x gridHeight" tiles while it's being decoded, 
+        // a 0 dimension is derived from the image's aspect ratio
+        static LabPlanes fetchImagePixelCIELABColors(string filePath_String, unsigned int gridWidth = 0, unsigned int gridHeight = 0);
         
-        static vector<Tile> matchPixelsAndPalletTiles(vector<CIELABColor> pixels, const vector<palletTile> palletTiles, bool silentMode);
+        // Decodes the image a band of "bandHeight" source rows at a time, box-filters
+        // it to the grid (one tile per pixel when no grid is given) and passes each
+        // finished row of CIELAB grid cells to "rowCallback". Returns "true" on error
+        static bool streamImageCIELABRows(string filePath_String, unsigned int gridWidth, unsigned int gridHeight, unsigned int bandHeight, function<void(unsigned int, vector<CIELABColor>&)> rowCallback);
+
+        // Matches the image band by band without ever holding 
+        // the full image's pixel colors in memory
+        static vector<Tile> matchImageStreaming(string filePath_String, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int bandHeight, bool silentMode);
+
+        // Decodes the image once and matches it a grid row per task on "threadCount" 
+        // threads, every row is box-filtered, converted and matched in one go so no 
+        // full image RGB or CIELAB arrays are ever built. "rowCallback" is called by 
+        // the thread that matched a row with the row's tiles, rows can finish in any order
+        static vector<Tile> matchImageFused(string filePath_String, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode, function<void(unsigned int, const Tile*)> rowCallback = nullptr);
+
+        static Tile matchPixel(const CIELABColor &pixel, const vector<palletTile> &palletTiles);
+
+        static bool generateMosaicImageFile(vector<Tile> tiles, Pallet pallet, bool silentMode, unsigned int threadCount);
+
+        // Writes the mosaic as a Deep Zoom (DZI) pyramid of "tileSize" PNG tiles, 
+        // every pyramid tile is composed on its own from the pallet tiles
+        static bool generateMosaicDeepZoom(const vector<Tile> &tiles, const Pallet &pallet, unsigned int tileSize, unsigned int threadCount, bool silentMode);
+
+        // Renders the "regionWidth x regionHeight" RGBA region at "(x, y)" of the mosaic scaled 
+        // by "scale", only the pallet tiles inside the region get decoded. Empty on error
+        static vector<uint8_t> renderMosaicRegion(const vector<Tile> &tiles, const Pallet &pallet, uint64_t x, uint64_t y, unsigned int regionWidth, unsigned int regionHeight, double scale, unsigned int threadCount);
 
-        static bool generateMosaicImageFile(vector<Tile> tiles, Pallet pallet, bool silentMode);
+        static bool generateMosaicRegionFile(const vector<Tile> &tiles, const Pallet &pallet, uint64_t x, uint64_t y, unsigned int regionWidth, unsigned int regionHeight, double scale, unsigned int threadCount);
 
         static void generateMosaicJSONFile(vector<Tile> tiles, Pallet pallet, string palletFilePath, uint64_t calculationTime, uint64_t generationTime);
 };
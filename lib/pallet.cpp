@@ -1,12 +1,119 @@
 #include "pallet.h"
 #include "json.hpp"
+#include <algorithm>
+#include <iostream>
 
 using json = nlohmann::json;
 
+unsigned int Pallet::clusterCount = 0;
+
 Pallet::Pallet(){
 
 }
 
+int Pallet::pickVariant(const vector<palletTile> &palletTiles, int palletId, uint64_t position){
+    if (palletId < 0 || (uint64_t)palletId >= palletTiles.size() || palletTiles[palletId].variantIds.size() < 1) return palletId;
+
+    // splitmix64 finalizer, neighboring cells get unrelated variants
+    uint64_t hash = position + 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+
+    uint64_t variant = hash % (palletTiles[palletId].variantIds.size() + 1);
+    return (variant == 0) ? palletId : palletTiles[palletId].variantIds[variant - 1];
+}
+
+const palletTile& Pallet::fetchTile(int palletId) const{
+    return ((uint64_t)palletId < tiles.size()) ? tiles[palletId] : variantTiles[palletId - tiles.size()];
+}
+
+uint64_t Pallet::tileCount() const{
+    return tiles.size() + variantTiles.size();
+}
+
+vector<palletCluster> Pallet::clusterTiles(const vector<palletTile> &tiles, unsigned int clusterCount){
+    vector<palletCluster> clusters;
+    if (tiles.size() < 1 || clusterCount < 1) return clusters;
+    if (clusterCount > tiles.size()) clusterCount = tiles.size();
+
+    // Centroids start at tiles spread evenly through the pallet, so the same pallet always clusters the same way
+    vector<CIELABColor> centroids;
+    centroids.resize(clusterCount);
+    for (unsigned int c = 0; c < clusterCount; c++) centroids[c] = tiles[(uint64_t)c * tiles.size() / clusterCount].labColor;
+
+    vector<unsigned int> assigned;
+    assigned.assign(tiles.size(), 0);
+    for (int iteration = 0; iteration < 16; iteration++){
+        bool changed = iteration == 0;
+        for (uint64_t i = 0; i < tiles.size(); i++){
+            unsigned int closest = 0;
+            double closestDeltaE = Colors::calcDeltaE(tiles[i].labColor, centroids[0]);
+            for (unsigned int c = 1; c < clusterCount; c++){
+                double deltaE = Colors::calcDeltaE(tiles[i].labColor, centroids[c]);
+                if (deltaE < closestDeltaE) {
+                    closestDeltaE = deltaE;
+                    closest = c;
+                }
+            }
+
+            if (assigned[i] != closest) changed = true;
+            assigned[i] = closest;
+        }
+        if (!changed) break;
+
+        // Centroids that lost every tile stay where they are
+        vector<double> sums;
+        vector<uint64_t> counts;
+        sums.assign(clusterCount * 3, 0);
+        counts.assign(clusterCount, 0);
+        for (uint64_t i = 0; i < tiles.size(); i++){
+            sums[assigned[i] * 3] += tiles[i].labColor.L;
+            sums[assigned[i] * 3 + 1] += tiles[i].labColor.a;
+            sums[assigned[i] * 3 + 2] += tiles[i].labColor.b;
+            counts[assigned[i]]++;
+        }
+        for (unsigned int c = 0; c < clusterCount; c++){
+            if (counts[c] > 0) centroids[c] = CIELABColor(sums[c * 3] / counts[c], sums[c * 3 + 1] / counts[c], sums[c * 3 + 2] / counts[c]);
+        }
+    }
+
+    vector<palletCluster> allClusters;
+    allClusters.resize(clusterCount);
+    for (unsigned int c = 0; c < clusterCount; c++) allClusters[c].centroid = centroids[c];
+    for (uint64_t i = 0; i < tiles.size(); i++) allClusters[assigned[i]].palletIds.push_back(i);
+
+    for (unsigned int c = 0; c < clusterCount; c++){
+        if (allClusters[c].palletIds.size() > 0) clusters.push_back(allClusters[c]);
+    }
+    updateClusterRadii(tiles, clusters);
+
+    return clusters;
+}
+
+void Pallet::updateClusterRadii(const vector<palletTile> &tiles, vector<palletCluster> &clusters){
+    for (palletCluster &cluster : clusters){
+        cluster.radius = 0;
+        for (int palletId : cluster.palletIds) cluster.radius = max(cluster.radius, Colors::calcDeltaE(cluster.centroid, tiles[palletId].labColor));
+    }
+}
+
+// Whether every one of the "tileCount" pallet tiles is in exactly one of "clusters"
+static bool coversEveryTileOnce(const vector<palletCluster> &clusters, uint64_t tileCount){
+    vector<bool> covered;
+    covered.resize(tileCount, false);
+    uint64_t memberCount = 0;
+    for (const palletCluster &cluster : clusters){
+        for (int palletId : cluster.palletIds){
+            if (palletId < 0 || (uint64_t)palletId >= tileCount || covered[palletId]) return 0;
+            covered[palletId] = true;
+        }
+        memberCount += cluster.palletIds.size();
+    }
+
+    return memberCount == tileCount;
+}
+
 void Pallet::fetchPalletTiles(Pallet *self, string palletFilePath){
     string jsonText;
 
@@ -26,6 +133,7 @@ void Pallet::fetchPalletTiles(Pallet *self, string palletFilePath){
         while (jsonData_tiles[jsonData_count] != nullptr) jsonData_count++;
 
         vector<palletTile> tiles;
+        vector<palletTile> variantTiles;
         tiles.resize(jsonData_count);
         for (int i = 0; i < jsonData_count; i++){
             tiles[i].name = jsonData_tiles[i]["name"];
@@ -36,13 +144,49 @@ void Pallet::fetchPalletTiles(Pallet *self, string palletFilePath){
                 jsonData_tiles[i]["CIELABColor"]["a"],
                 jsonData_tiles[i]["CIELABColor"]["b"]
             );
+
+            if (!jsonData_tiles[i].contains("variants")) continue;
+            for (const json &jsonData_variant : jsonData_tiles[i]["variants"]){
+                palletTile variant;
+                variant.name = jsonData_variant["name"];
+                variant.fileType = jsonData_variant["fileType"];
+                variant.labColor = CIELABColor(
+                    jsonData_variant["CIELABColor"]["L"], 
+                    jsonData_variant["CIELABColor"]["a"],
+                    jsonData_variant["CIELABColor"]["b"]
+                );
+
+                tiles[i].variantIds.push_back(jsonData_count + variantTiles.size());
+                variantTiles.push_back(variant);
+            }
         }
 
         self->tiles = tiles;
+        self->variantTiles = variantTiles;
+
+        // Radii are measured again, the rounded colors in the file mustn't make them too small
+        self->clusters.clear();
+        if (jsonData.contains("clusters")) {
+            for (const json &jsonData_cluster : jsonData["clusters"]){
+                palletCluster cluster;
+                cluster.centroid = CIELABColor(jsonData_cluster["L"], jsonData_cluster["a"], jsonData_cluster["b"]);
+                for (const json &palletId : jsonData_cluster["tiles"]) cluster.palletIds.push_back(palletId);
+                self->clusters.push_back(cluster);
+            }
+
+            if (coversEveryTileOnce(self->clusters, self->tiles.size())) updateClusterRadii(self->tiles, self->clusters);
+            else {
+                cout << "Warning: Clusters of \"" << palletFilePath << "\" don't cover every tile exactly once, ignoring them\n";
+                self->clusters.clear();
+            }
+        }
+        if (self->clusters.size() < 1 && clusterCount > 0) self->clusters = clusterTiles(self->tiles, clusterCount);
+
         return;
     } catch(exception) {
         vector<palletTile> tiles;
         self->tiles = tiles;
+        self->variantTiles = tiles;
         return; 
     }
 }
\ No newline at end of file
@@ -13,6 +13,17 @@ struct palletTile{
     string name;
 	string fileType;
     CIELABColor labColor;
+
+    // Pallet ids of the near-duplicate tiles that can stand in for this one
+    vector<int> variantIds;
+};
+
+// Pallet tiles around a k-means centroid, every member 
+// is within "radius" (CIE76) of the centroid
+struct palletCluster{
+    CIELABColor centroid;
+    double radius;
+    vector<int> palletIds;
 };
 
 class Pallet{
@@ -21,8 +32,36 @@ class Pallet{
         string palletTilesDirPath;
         vector<palletTile> tiles;
 
+        // Near-duplicate tiles kept as variants of "tiles", they're never matched against. 
+        // A variant's palletId is its index in here plus the number of "tiles"
+        vector<palletTile> variantTiles;
+
+        // Clusters of the tiles' colors, read from the pallet file or made 
+        // on load when "clusterCount" is set and the file has none
+        vector<palletCluster> clusters;
+
+        // Clusters pallets get on load when their file has none, 0 for none
+        static unsigned int clusterCount;
+
         static void fetchPalletTiles(Pallet *self, string palletFilePath);
 
+        // Picks the tile or one of its variants from a hash of the cell's 
+        // position, so the same image always gets the same variants
+        static int pickVariant(const vector<palletTile> &palletTiles, int palletId, uint64_t position);
+
+        // Tile of any palletId, variants included
+        const palletTile& fetchTile(int palletId) const;
+
+        // Number of palletIds, variants included
+        uint64_t tileCount() const;
+
+        // Runs k-means over the tiles' colors with up to "clusterCount" clusters, 
+        // empty clusters are left out
+        static vector<palletCluster> clusterTiles(const vector<palletTile> &tiles, unsigned int clusterCount);
+
+        // Sets every cluster's radius to its furthest member
+        static void updateClusterRadii(const vector<palletTile> &tiles, vector<palletCluster> &clusters);
+
         Pallet();
 };
 
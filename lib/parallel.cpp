@@ -0,0 +1,106 @@
+#include "parallel.h"
+#include <algorithm>
+
+unsigned int Parallel::defaultThreadCount(){
+    unsigned int threadCount = thread::hardware_concurrency();
+    return (threadCount > 0) ? threadCount : 1;
+}
+
+void Parallel::forEach(uint64_t count, unsigned int threadCount, function<void(uint64_t)> task){
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > count) threadCount = count;
+
+    // Not worth spinning up threads for
+    if (threadCount <= 1){
+        for (uint64_t i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    atomic<uint64_t> nextIndex(0);
+    vector<thread> workers;
+    for (unsigned int t = 0; t < threadCount; t++){
+        workers.push_back(thread([&](){
+            for (uint64_t i = nextIndex++; i < count; i = nextIndex++) task(i);
+        }));
+    }
+
+    for (uint64_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+MemoryBudget::MemoryBudget(uint64_t limit){
+    this->limit = limit;
+    this->inFlight = 0;
+}
+
+void MemoryBudget::acquire(uint64_t bytes){
+    unique_lock<mutex> lock(budgetMutex);
+    released.wait(lock, [&](){ return inFlight == 0 || inFlight + bytes <= limit; });
+    inFlight += bytes;
+}
+
+void MemoryBudget::release(uint64_t bytes){
+    {
+        lock_guard<mutex> lock(budgetMutex);
+        inFlight -= bytes;
+    }
+    released.notify_all();
+}
+
+BandRing::BandRing(uint64_t bandBytes, unsigned int slotCount){
+    this->composeStallTime = 0;
+    this->writeStallTime = 0;
+    this->releasedBands = 0;
+    this->stopped = false;
+
+    slots.resize(max(slotCount, 1u));
+    for (vector<uint8_t> &slot : slots) slot.resize(bandBytes);
+    published.assign(slots.size(), false);
+}
+
+// Waits for "ready" and adds the time it took to "stallTime" if it wasn't ready right away
+static void waitTimed(unique_lock<mutex> &lock, condition_variable &changed, uint64_t &stallTime, function<bool()> ready){
+    if (ready()) return;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    changed.wait(lock, ready);
+    stallTime += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+uint8_t* BandRing::acquire(uint64_t band){
+    unique_lock<mutex> lock(ringMutex);
+    waitTimed(lock, changed, composeStallTime, [&](){ return stopped || band < releasedBands + slots.size(); });
+
+    return stopped ? nullptr : slots[band % slots.size()].data();
+}
+
+void BandRing::publish(uint64_t band){
+    {
+        lock_guard<mutex> lock(ringMutex);
+        published[band % slots.size()] = true;
+    }
+    changed.notify_all();
+}
+
+const uint8_t* BandRing::next(uint64_t band){
+    unique_lock<mutex> lock(ringMutex);
+    waitTimed(lock, changed, writeStallTime, [&](){ return stopped || published[band % slots.size()]; });
+
+    return stopped ? nullptr : slots[band % slots.size()].data();
+}
+
+void BandRing::release(uint64_t band){
+    {
+        lock_guard<mutex> lock(ringMutex);
+        published[band % slots.size()] = false;
+        releasedBands = band + 1;
+    }
+    changed.notify_all();
+}
+
+void BandRing::stop(){
+    {
+        lock_guard<mutex> lock(ringMutex);
+        stopped = true;
+    }
+    changed.notify_all();
+}
@@ -0,0 +1,76 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#pragma once
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using namespace std;
+
+class Parallel{
+    public:
+        // Number of hardware threads, at least 1
+        static unsigned int defaultThreadCount();
+
+        // Runs "task" for every index in [0, count) on "threadCount" threads, 
+        // indices are handed out dynamically so uneven tasks still balance out
+        static void forEach(uint64_t count, unsigned int threadCount, function<void(uint64_t)> task);
+};
+
+// Caps how many bytes worker threads may hold at once, "acquire" blocks 
+// until enough has been released. A single request bigger than the whole 
+// budget is still let through once nothing else is in flight
+class MemoryBudget{
+    public:
+        uint64_t limit;
+
+        void acquire(uint64_t bytes);
+        void release(uint64_t bytes);
+
+        MemoryBudget(uint64_t limit);
+
+    private:
+        uint64_t inFlight;
+        mutex budgetMutex;
+        condition_variable released;
+};
+
+// Fixed ring of output bands between the threads composing them and a 
+// writer thread encoding them in order. A band's slot is only handed out 
+// again once the writer released the band before it in that slot, so 
+// composing runs at most "slotCount" bands ahead of the writer
+class BandRing{
+    public:
+        // Microseconds spent waiting for a free slot and for the next band to be ready
+        uint64_t composeStallTime;
+        uint64_t writeStallTime;
+
+        // Blocks until "band"'s slot is free, nullptr once the ring is stopped
+        uint8_t* acquire(uint64_t band);
+        void publish(uint64_t band);
+
+        // Blocks until "band" is published, bands have to be taken in order. 
+        // nullptr once the ring is stopped
+        const uint8_t* next(uint64_t band);
+        void release(uint64_t band);
+
+        // Wakes every waiting thread after an error, nothing is handed out anymore
+        void stop();
+
+        BandRing(uint64_t bandBytes, unsigned int slotCount);
+
+    private:
+        vector<vector<uint8_t>> slots;
+        vector<bool> published;
+        uint64_t releasedBands;
+        bool stopped;
+        mutex ringMutex;
+        condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "pipeline.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include "mosaic.h"
+#include "tilestore.h"
+
+bool MosaicPipeline::run(string inputImagePath, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode, vector<Tile> &tiles){
+    const unsigned int channels = 4;
+    const unsigned int tileSize = pallet.minResolution;
+    const unsigned int rowWindow = max(2u, threadCount * rowsPerThread);
+    const unsigned int compositorCount = max(1u, threadCount / 2);
+
+    // The tiles a row needs aren't known until it's matched, so they're decoded on first use
+    TileStore tileStore;
+    tileStore.openLazy(pallet);
+
+    mutex pipelineMutex;
+    condition_variable changed;
+    map<unsigned int, vector<Tile>> matchedRows;
+    unsigned int nextComposedRow = 0;
+    bool matchingDone = false;
+    bool failed = false;
+
+    // The ring and the encoder are only set up once the first row is matched, 
+    // that's when the image's name and size are known
+    unique_ptr<BandRing> bands;
+    thread encoder;
+    auto fail = [&](){
+        failed = true;
+        if (bands) bands->stop();
+        changed.notify_all();
+    };
+
+    // Rows are taken in order so the compositor waiting for 
+    // a free band always is the one the encoder needs next
+    vector<thread> compositors;
+    for (unsigned int t = 0; t < compositorCount; t++){
+        compositors.emplace_back([&](){
+            unique_lock<mutex> lock(pipelineMutex);
+            while (true){
+                changed.wait(lock, [&](){ return failed || matchingDone || matchedRows.count(nextComposedRow) > 0; });
+                if (failed || matchedRows.count(nextComposedRow) < 1) return;
+
+                unsigned int row = nextComposedRow++;
+                vector<Tile> rowTiles = move(matchedRows[row]);
+                matchedRows.erase(row);
+                changed.notify_all();
+                lock.unlock();
+
+                uint8_t *band = bands->acquire(row);
+                bool result = band == nullptr || tileStore.composeRow(rowTiles.data(), Mosaic::imageWidth, band);
+                if (!result) bands->publish(row);
+
+                lock.lock();
+                if (result) fail();
+            }
+        });
+    }
+
+    auto encode = [&](){
+        const string outputFilePath = Mosaic::imageName + "_mosaic." + Mosaic::imageFormat;
+        ImageWriter *writer = Mosaic::createImageWriter(threadCount);
+        bool result = writer->open(outputFilePath, (uint64_t)Mosaic::imageWidth * tileSize, (uint64_t)Mosaic::imageHeight * tileSize, channels);
+
+        for (unsigned int row = 0; row < Mosaic::imageHeight && !result; row++){
+            const uint8_t *band = bands->next(row);
+            result = band == nullptr || writer->writeRows(band, tileSize);
+            bands->release(row);
+        }
+
+        result = writer->close() || result;
+        delete writer;
+
+        if (result) {
+            lock_guard<mutex> lock(pipelineMutex);
+            fail();
+        }
+    };
+
+    // Matcher threads wait before handing over a row that's too far ahead 
+    // of the compositors, so at most "rowWindow" matched rows are queued
+    tiles = Mosaic::matchImageFused(inputImagePath, pallet.tiles, gridWidth, gridHeight, threadCount, silentMode, 
+        [&](unsigned int row, const Tile *rowTiles){
+            unique_lock<mutex> lock(pipelineMutex);
+            if (!bands) {
+                bands.reset(new BandRing((uint64_t)Mosaic::imageWidth * tileSize * tileSize * channels, Mosaic::outputBandBuffers));
+                encoder = thread(encode);
+            }
+
+            changed.wait(lock, [&](){ return failed || row < nextComposedRow + rowWindow; });
+            if (failed) return;
+
+            matchedRows[row] = vector<Tile>(rowTiles, rowTiles + Mosaic::imageWidth);
+            changed.notify_all();
+        }
+    );
+
+    {
+        lock_guard<mutex> lock(pipelineMutex);
+        matchingDone = true;
+        if (tiles.size() < 1) fail();
+        changed.notify_all();
+    }
+
+    for (thread &compositor : compositors) compositor.join();
+    if (encoder.joinable()) encoder.join();
+
+    if (bands) cout << "Output bands: compositors stalled for " << (double)bands->composeStallTime / 1000000 
+        << " s, encoder stalled for " << (double)bands->writeStallTime / 1000000 << " s\n";
+
+    return failed;
+}
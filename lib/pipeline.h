@@ -0,0 +1,26 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include "tile.h"
+#include "pallet.h"
+
+using namespace std;
+
+// Matches the image and writes the mosaic image file at the same time. 
+// Matcher threads hand every finished tile row to compositor threads 
+// through a bounded queue, and a single encoder thread writes the 
+// composed rows to the file in order as soon as they're ready
+class MosaicPipeline{
+    public:
+        // Tile rows per thread that may be matched ahead of the encoder
+        static const unsigned int rowsPerThread = 2;
+
+        // "tiles" gets every match for the JSON file, returns "true" on error
+        static bool run(string inputImagePath, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode, vector<Tile> &tiles);
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "pngwriter.h"
+#include <cstring>
+#include <cstdlib>
+#include "deflate.h"
+#include "parallel.h"
+
+namespace {
+    // Raw bytes per piece of scanlines handed to a thread, small enough 
+    // to balance well and big enough that restarting the deflate window 
+    // at every piece barely costs any compression
+    const uint64_t PIECE_SIZE = 256 * 1024;
+
+    struct CompressedPiece{
+        vector<uint8_t> data;
+        uint64_t rawSize;
+        uint32_t adler;
+        uint32_t crc;
+    };
+
+    void putUInt32(vector<uint8_t> &out, uint32_t value){
+        out.push_back(value >> 24);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back(value & 0xFF);
+    }
+
+    uint32_t chunkCRC(const char *type, const uint8_t *data, uint64_t size){
+        return Deflate::crc32(data, size, Deflate::crc32((const uint8_t*)type, 4));
+    }
+}
+
+PNGWriter::PNGWriter(){
+    compressionLevel = 6;
+    filter = PNG_FILTER_ADAPTIVE;
+    width = 0;
+    height = 0;
+    channels = 0;
+    rowsWritten = 0;
+    adler = 1;
+}
+
+PNGWriter::~PNGWriter(){
+    if (stream.is_open()) stream.close();
+}
+
+bool PNGWriter::parseFilter(string name, PNGFilter *filter){
+    if (name == "none") *filter = PNG_FILTER_NONE;
+    else if (name == "sub") *filter = PNG_FILTER_SUB;
+    else if (name == "up") *filter = PNG_FILTER_UP;
+    else if (name == "average") *filter = PNG_FILTER_AVERAGE;
+    else if (name == "paeth") *filter = PNG_FILTER_PAETH;
+    else if (name == "adaptive") *filter = PNG_FILTER_ADAPTIVE;
+    else return 1;
+
+    return 0;
+}
+
+bool PNGWriter::open(string filePath, unsigned int width, unsigned int height, unsigned int channels){
+    if (channels < 1 || channels > 4) return 1;
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    rowsWritten = 0;
+    adler = 1;
+    previousRow.clear();
+
+    stream.open(filePath, ios::binary);
+    if (!stream.is_open()) return 1;
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    stream.write((const char*)signature, 8);
+
+    // 1 gray, 2 gray + alpha, 3 RGB, 4 RGBA
+    const uint8_t colorTypes[5] = {0, 0, 4, 2, 6};
+    vector<uint8_t> header;
+    putUInt32(header, width);
+    putUInt32(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(colorTypes[channels]);
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // no interlace
+    writeChunk("IHDR", header.data(), header.size(), chunkCRC("IHDR", header.data(), header.size()));
+
+    return !stream.good();
+}
+
+void PNGWriter::filterRow(const uint8_t *row, const uint8_t *previous, uint64_t rowSize, unsigned int bytesPerPixel, PNGFilter filter, uint8_t *out, uint8_t *scratch){
+    if (filter == PNG_FILTER_ADAPTIVE){
+        // Try every filter and keep the one whose output looks the most like 
+        // small signed numbers, which is what deflate compresses best
+        uint64_t bestSum = UINT64_MAX;
+        for (int f = PNG_FILTER_NONE; f <= PNG_FILTER_PAETH; f++){
+            filterRow(row, previous, rowSize, bytesPerPixel, (PNGFilter)f, scratch, nullptr);
+
+            uint64_t sum = 0;
+            for (uint64_t i = 1; i <= rowSize; i++) sum += abs((int8_t)scratch[i]);
+
+            if (sum < bestSum){
+                bestSum = sum;
+                memcpy(out, scratch, rowSize + 1);
+            }
+        }
+        return;
+    }
+
+    out[0] = filter;
+    for (uint64_t i = 0; i < rowSize; i++){
+        int a = (i >= bytesPerPixel) ? row[i - bytesPerPixel] : 0;
+        int b = previous[i];
+        int c = (i >= bytesPerPixel) ? previous[i - bytesPerPixel] : 0;
+
+        int predictor = 0;
+        if (filter == PNG_FILTER_SUB) predictor = a;
+        else if (filter == PNG_FILTER_UP) predictor = b;
+        else if (filter == PNG_FILTER_AVERAGE) predictor = (a + b) / 2;
+        else if (filter == PNG_FILTER_PAETH) {
+            int p = a + b - c;
+            int pa = abs(p - a);
+            int pb = abs(p - b);
+            int pc = abs(p - c);
+            predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+        }
+
+        out[i + 1] = (uint8_t)(row[i] - predictor);
+    }
+}
+
+bool PNGWriter::writeRows(const uint8_t *rows, unsigned int rowCount){
+    if (!stream.is_open() || rowsWritten + rowCount > height) return 1;
+    if (rowCount == 0) return 0;
+
+    const uint64_t rowSize = (uint64_t)width * channels;
+    const uint64_t filteredRowSize = rowSize + 1;
+    const unsigned int pieceRows = max((uint64_t)1, PIECE_SIZE / filteredRowSize);
+    const uint64_t pieceCount = (rowCount + pieceRows - 1) / pieceRows;
+
+    // The first row of the image is filtered against a row of zeros
+    if (previousRow.size() < 1) previousRow.resize(rowSize, 0);
+
+    // Only a couple of pieces per thread are in flight at once 
+    // so memory stays bounded no matter how many rows are passed
+    const uint64_t batchSize = (uint64_t)max(threadCount, 1u) * 2;
+    for (uint64_t firstPiece = 0; firstPiece < pieceCount; firstPiece += batchSize){
+        uint64_t batchPieces = min(batchSize, pieceCount - firstPiece);
+        vector<CompressedPiece> pieces;
+        pieces.resize(batchPieces);
+
+        Parallel::forEach(batchPieces, threadCount, [&](uint64_t p){
+            uint64_t piece = firstPiece + p;
+            uint64_t firstRow = piece * pieceRows;
+            uint64_t lastRow = min(firstRow + pieceRows, (uint64_t)rowCount);
+
+            vector<uint8_t> filtered;
+            vector<uint8_t> scratch;
+            filtered.resize((lastRow - firstRow) * filteredRowSize);
+            scratch.resize(filteredRowSize);
+            for (uint64_t r = firstRow; r < lastRow; r++){
+                const uint8_t *previous = (r == 0) ? previousRow.data() : rows + (r - 1) * rowSize;
+                filterRow(rows + r * rowSize, previous, rowSize, channels, filter, filtered.data() + (r - firstRow) * filteredRowSize, scratch.data());
+            }
+
+            CompressedPiece &out = pieces[p];
+            out.rawSize = filtered.size();
+            out.adler = Deflate::adler32(filtered.data(), filtered.size());
+
+            // The very first piece of the image also carries the zlib header
+            if (rowsWritten == 0 && piece == 0){
+                const uint8_t levelFlags[4] = {0x01, 0x5E, 0x9C, 0xDA};
+                out.data.push_back(0x78);
+                out.data.push_back(levelFlags[(compressionLevel <= 1) ? 0 : (compressionLevel <= 5) ? 1 : (compressionLevel <= 7) ? 2 : 3]);
+            }
+            Deflate::compress(filtered.data(), filtered.size(), compressionLevel, false, out.data);
+            out.crc = chunkCRC("IDAT", out.data.data(), out.data.size());
+        });
+
+        for (uint64_t p = 0; p < batchPieces; p++){
+            writeChunk("IDAT", pieces[p].data.data(), pieces[p].data.size(), pieces[p].crc);
+            adler = Deflate::adler32Combine(adler, pieces[p].adler, pieces[p].rawSize);
+        }
+    }
+
+    memcpy(previousRow.data(), rows + (uint64_t)(rowCount - 1) * rowSize, rowSize);
+    rowsWritten += rowCount;
+
+    return !stream.good();
+}
+
+bool PNGWriter::close(){
+    if (!stream.is_open()) return 1;
+
+    bool failed = rowsWritten != height;
+
+    // Final empty deflate block and the Adler-32 of all the filtered rows
+    vector<uint8_t> trailer;
+    if (rowsWritten == 0) {
+        trailer.push_back(0x78);
+        trailer.push_back(0x01);
+    }
+    Deflate::compress(nullptr, 0, compressionLevel, true, trailer);
+    putUInt32(trailer, adler);
+    writeChunk("IDAT", trailer.data(), trailer.size(), chunkCRC("IDAT", trailer.data(), trailer.size()));
+
+    writeChunk("IEND", nullptr, 0, chunkCRC("IEND", nullptr, 0));
+
+    failed = failed || !stream.good();
+    stream.close();
+
+    return failed;
+}
+
+void PNGWriter::writeChunk(const char *type, const uint8_t *data, uint64_t size, uint32_t crc){
+    vector<uint8_t> header;
+    putUInt32(header, size);
+    header.insert(header.end(), type, type + 4);
+    stream.write((const char*)header.data(), header.size());
+
+    if (size > 0) stream.write((const char*)data, size);
+
+    vector<uint8_t> footer;
+    putUInt32(footer, crc);
+    stream.write((const char*)footer.data(), footer.size());
+}
+
+bool PNGWriter::write(string filePath, unsigned int width, unsigned int height, unsigned int channels, const uint8_t *data, int compressionLevel, PNGFilter filter, unsigned int threadCount){
+    PNGWriter writer;
+    writer.compressionLevel = compressionLevel;
+    writer.filter = filter;
+    writer.threadCount = threadCount;
+
+    if (writer.open(filePath, width, height, channels)) return 1;
+    bool failed = writer.writeRows(data, height);
+
+    return writer.close() || failed;
+}
@@ -0,0 +1,66 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "imagewriter.h"
+
+using namespace std;
+
+enum PNGFilter{
+    PNG_FILTER_NONE = 0,
+    PNG_FILTER_SUB = 1,
+    PNG_FILTER_UP = 2,
+    PNG_FILTER_AVERAGE = 3,
+    PNG_FILTER_PAETH = 4,
+    // Picks the filter with the smallest sum of absolute differences for every row
+    PNG_FILTER_ADAPTIVE = 5
+};
+
+// Streaming 8-bit PNG encoder. Rows are split into independent pieces of 
+// scanlines that are filtered and deflated on "threadCount" threads, each 
+// piece becomes its own IDAT chunk of one shared zlib stream
+class PNGWriter : public ImageWriter{
+    public:
+        // 0 (store only) to 9 (smallest)
+        int compressionLevel;
+        PNGFilter filter;
+
+        // Returns "true" if the file couldn't be created
+        bool open(string filePath, unsigned int width, unsigned int height, unsigned int channels) override;
+
+        // Appends "rowCount" rows of "width * channels" bytes, returns "true" on error
+        bool writeRows(const uint8_t *rows, unsigned int rowCount) override;
+
+        // Finishes the zlib stream and the file, returns "true" on error
+        bool close() override;
+
+        // Writes a whole image in one go, returns "true" on error
+        static bool write(string filePath, unsigned int width, unsigned int height, unsigned int channels, const uint8_t *data, int compressionLevel, PNGFilter filter, unsigned int threadCount);
+
+        // Parses "none", "sub", "up", "average", "paeth" or "adaptive", returns "true" on error
+        static bool parseFilter(string name, PNGFilter *filter);
+
+        PNGWriter();
+
+        ~PNGWriter() override;
+
+    private:
+        ofstream stream;
+        unsigned int width;
+        unsigned int height;
+        unsigned int channels;
+        unsigned int rowsWritten;
+        uint32_t adler;
+        vector<uint8_t> previousRow;
+
+        void writeChunk(const char *type, const uint8_t *data, uint64_t size, uint32_t crc);
+
+        // "scratch" needs "rowSize + 1" bytes and is only used by the adaptive filter
+        static void filterRow(const uint8_t *row, const uint8_t *previous, uint64_t rowSize, unsigned int bytesPerPixel, PNGFilter filter, uint8_t *out, uint8_t *scratch);
+};
+
+#endif
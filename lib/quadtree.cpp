@@ -0,0 +1,130 @@
+#include "quadtree.h"
+#include <atomic>
+#include <mutex>
+#include <cmath>
+#include "matcher.h"
+#include "parallel.h"
+
+unsigned int AdaptiveGrid::maxBlockSize = 0;
+double AdaptiveGrid::maxDeltaE = 4;
+
+bool AdaptiveGrid::enabled(){
+    return maxBlockSize > 1;
+}
+
+struct GridBlock{
+    unsigned int x;
+    unsigned int y;
+    unsigned int size;
+    CIELABColor mean;
+};
+
+// Mean color of the block, "false" if the block can't be covered by a single tile
+static bool blockMean(const LabPlanes &pixels, unsigned int gridWidth, unsigned int gridHeight, const GridBlock &block, CIELABColor &mean){
+    if (block.x + block.size > gridWidth || block.y + block.size > gridHeight) return false;
+
+    double sum[3] = {0, 0, 0};
+    double squareSum = 0;
+    uint64_t transparentCells = 0;
+    for (unsigned int y = block.y; y < block.y + block.size; y++){
+        for (unsigned int x = block.x; x < block.x + block.size; x++){
+            uint64_t i = (uint64_t)y * gridWidth + x;
+            if (pixels.isTransparent(i)) {
+                transparentCells++;
+                continue;
+            }
+
+            sum[0] += pixels.L[i];
+            sum[1] += pixels.a[i];
+            sum[2] += pixels.b[i];
+            squareSum += (double)pixels.L[i] * pixels.L[i] + (double)pixels.a[i] * pixels.a[i] + (double)pixels.b[i] * pixels.b[i];
+        }
+    }
+
+    // Transparent cells only merge with other transparent cells
+    const uint64_t cellCount = (uint64_t)block.size * block.size;
+    if (transparentCells == cellCount) {
+        mean = CIELABColor(0, 0, 0, true);
+        return true;
+    }
+    if (transparentCells > 0) return false;
+
+    mean = CIELABColor(sum[0] / cellCount, sum[1] / cellCount, sum[2] / cellCount);
+    double variance = squareSum / cellCount - (mean.L * mean.L + mean.a * mean.a + mean.b * mean.b);
+
+    return variance <= AdaptiveGrid::maxDeltaE * AdaptiveGrid::maxDeltaE;
+}
+
+// Collects the quadtree's leaves under "block" into "leaves"
+static void subdivide(const LabPlanes &pixels, unsigned int gridWidth, unsigned int gridHeight, GridBlock block, vector<GridBlock> &leaves){
+    if (block.size == 1) {
+        block.mean = pixels.get((uint64_t)block.y * gridWidth + block.x);
+        leaves.push_back(block);
+        return;
+    }
+    if (blockMean(pixels, gridWidth, gridHeight, block, block.mean)) {
+        leaves.push_back(block);
+        return;
+    }
+
+    // Quarters that lie outside of the grid are left out
+    unsigned int half = block.size / 2;
+    for (unsigned int q = 0; q < 4; q++){
+        GridBlock quarter;
+        quarter.x = block.x + (q & 1) * half;
+        quarter.y = block.y + (q >> 1) * half;
+        quarter.size = half;
+        if (quarter.x < gridWidth && quarter.y < gridHeight) subdivide(pixels, gridWidth, gridHeight, quarter, leaves);
+    }
+}
+
+vector<Tile> AdaptiveGrid::match(const LabPlanes &pixels, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode){
+    vector<Tile> tiles;
+    tiles.resize((uint64_t)gridWidth * gridHeight);
+
+    TileMatcher matcher(palletTiles);
+    const unsigned int rootsX = (gridWidth + maxBlockSize - 1) / maxBlockSize;
+    const unsigned int rootsY = (gridHeight + maxBlockSize - 1) / maxBlockSize;
+    atomic<uint64_t> blockCount(0);
+    atomic<unsigned int> rowsMatched(0);
+    mutex progressMutex;
+
+    // Every row of root blocks is split and matched on its own, 
+    // the blocks never overlap so every cell is written once
+    Parallel::forEach(rootsY, threadCount, [&](uint64_t rootY){
+        vector<GridBlock> leaves;
+        for (unsigned int rootX = 0; rootX < rootsX; rootX++){
+            GridBlock root;
+            root.x = rootX * maxBlockSize;
+            root.y = rootY * maxBlockSize;
+            root.size = maxBlockSize;
+            subdivide(pixels, gridWidth, gridHeight, root, leaves);
+        }
+
+        for (const GridBlock &block : leaves){
+            uint64_t firstCell = (uint64_t)block.y * gridWidth + block.x;
+            Tile tile = matcher.match(block.mean, firstCell);
+            tile.blockSize = block.size;
+
+            for (unsigned int y = block.y; y < block.y + block.size; y++){
+                for (unsigned int x = block.x; x < block.x + block.size; x++){
+                    uint64_t pixelId = (uint64_t)y * gridWidth + x;
+                    tiles[pixelId] = tile;
+                    tiles[pixelId].pixelId = pixelId;
+                }
+            }
+        }
+        blockCount += leaves.size();
+
+        unsigned int row = ++rowsMatched;
+        if (silentMode) return;
+        lock_guard<mutex> lock(progressMutex);
+        cout << "Progress: "
+            << (int)((float)row / (float)rootsY * 100) << "%"
+            << " (" << row << " / " << rootsY << ") block rows matched\n";
+    });
+
+    matcher.printMismatchRate();
+    cout << "Adaptive tiles: " << blockCount << " blocks matched for " << tiles.size() << " cells\n";
+    return tiles;
+}
@@ -0,0 +1,30 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include "tile.h"
+#include "colors.h"
+#include "pallet.h"
+#include "labplanes.h"
+
+using namespace std;
+
+// Splits the grid into square blocks with a quadtree on CIELAB variance, 
+// so flat regions are covered by a few big tiles and detailed ones by 
+// single cell tiles. Every block is matched once by its mean color
+class AdaptiveGrid{
+    public:
+        // Side in cells of the biggest blocks, a power of two. 0 turns adaptive tiles off
+        static unsigned int maxBlockSize;
+
+        // Blocks whose cells are further than this (RMS deltaE) from their mean are split
+        static double maxDeltaE;
+
+        static bool enabled();
+
+        static vector<Tile> match(const LabPlanes &pixels, const vector<palletTile> &palletTiles, unsigned int gridWidth, unsigned int gridHeight, unsigned int threadCount, bool silentMode);
+};
+
+#endif
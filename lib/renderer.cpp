@@ -0,0 +1,219 @@
+#include "renderer.h"
+#include "mosaic.h"
+#include "parallel.h"
+#include "tilestore.h"
+
+MosaicRenderer::MosaicRenderer(const vector<Tile> &tiles, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight) 
+    : tiles(tiles), pallet(pallet), decodeBudget(Mosaic::tileDecodeMemory){
+    this->gridWidth = gridWidth;
+    this->gridHeight = gridHeight;
+    this->tileSize = pallet.minResolution;
+    this->width = (uint64_t)gridWidth * tileSize;
+    this->height = (uint64_t)gridHeight * tileSize;
+
+    loadedTiles.resize(pallet.tileCount());
+    tileLoaded.reset(new once_flag[pallet.tileCount()]);
+}
+
+bool MosaicRenderer::decodeTile(const Pallet &pallet, int palletId, RenderTile &tile, MemoryBudget *decodeBudget){
+    const unsigned int R = pallet.minResolution;
+
+    tile.pixels = Mosaic::fetchPalletTilePixels(pallet, palletId, decodeBudget);
+    if (tile.pixels.size() < (uint64_t)R * R * 4) return 1;
+
+    tile.sums.assign((uint64_t)(R + 1) * (R + 1) * 4, 0);
+
+    for (unsigned int y = 0; y < R; y++){
+        uint32_t rowSum[4] = {0, 0, 0, 0};
+        for (unsigned int x = 0; x < R; x++){
+            const uint8_t *pixel = &tile.pixels[((uint64_t)y * R + x) * 4];
+
+            // Premultiplied so transparent pixels don't bleed their color into averages
+            rowSum[0] += (pixel[0] * pixel[3] + 127) / 255;
+            rowSum[1] += (pixel[1] * pixel[3] + 127) / 255;
+            rowSum[2] += (pixel[2] * pixel[3] + 127) / 255;
+            rowSum[3] += pixel[3];
+
+            uint64_t satIndex = ((uint64_t)(y + 1) * (R + 1) + (x + 1)) * 4;
+            uint64_t satIndexAbove = ((uint64_t)y * (R + 1) + (x + 1)) * 4;
+            for (int c = 0; c < 4; c++) tile.sums[satIndex + c] = tile.sums[satIndexAbove + c] + rowSum[c];
+        }
+    }
+
+    const uint64_t lastSum = ((uint64_t)R * (R + 1) + R) * 4;
+    for (int c = 0; c < 4; c++) tile.average[c] = (double)tile.sums[lastSum + c] / ((double)R * R);
+
+    return 0;
+}
+
+bool MosaicRenderer::loadTiles(unsigned int threadCount){
+    // Only the pallet tiles the grid actually uses get decoded
+    vector<int> usedPalletIds = TileStore::usedPalletIds(tiles, pallet.tileCount());
+
+    atomic<bool> failed(false);
+    Parallel::forEach(usedPalletIds.size(), threadCount, [&](uint64_t i){
+        if (loadTile(usedPalletIds[i]) == nullptr) failed = true;
+    });
+
+    if (failed) {
+        cout << "error: Unable to load pallet image file\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+const RenderTile* MosaicRenderer::loadTile(int palletId){
+    // The decode runs outside of any lock, threads only wait on the tile they need
+    call_once(tileLoaded[palletId], [&](){
+        if (decodeTile(pallet, palletId, loadedTiles[palletId], &decodeBudget)) loadedTiles[palletId].pixels.clear();
+    });
+
+    return loadedTiles[palletId].pixels.empty() ? nullptr : &loadedTiles[palletId];
+}
+
+const RenderTile* MosaicRenderer::fetchTile(int palletId){
+    const RenderTile *tile = loadTile(palletId);
+    if (tile == nullptr) cout << "error: Unable to load pallet image file\n";
+
+    return tile;
+}
+
+void MosaicRenderer::sumTileBox(const RenderTile *tile, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, uint64_t *sum){
+    if (tile == nullptr) return;
+
+    const vector<uint32_t> &sums = tile->sums;
+    const uint64_t stride = tileSize + 1;
+    for (int c = 0; c < 4; c++){
+        sum[c] += (uint64_t)sums[(y1 * stride + x1) * 4 + c] + sums[(y0 * stride + x0) * 4 + c]
+            - sums[(y0 * stride + x1) * 4 + c] - sums[(y1 * stride + x0) * 4 + c];
+    }
+}
+
+bool MosaicRenderer::renderRegion(uint64_t x, uint64_t y, unsigned int regionWidth, unsigned int regionHeight, double scale, uint8_t *out){
+    const unsigned int R = tileSize;
+    const double inverseScale = 1.0 / scale;
+
+    // Full resolution box covered by the whole region
+    const double regionX0 = min((double)x * inverseScale, (double)width);
+    const double regionY0 = min((double)y * inverseScale, (double)height);
+    const double regionX1 = min((double)(x + regionWidth) * inverseScale, (double)width);
+    const double regionY1 = min((double)(y + regionHeight) * inverseScale, (double)height);
+
+    // Fetch the tiles of every grid cell the region touches, 
+    // this is the only place where pallet tiles get decoded
+    const uint64_t cx0 = min((uint64_t)(regionX0 / R), (uint64_t)gridWidth);
+    const uint64_t cy0 = min((uint64_t)(regionY0 / R), (uint64_t)gridHeight);
+    const uint64_t cx1 = min((uint64_t)ceil(regionX1 / R) + 1, (uint64_t)gridWidth);
+    const uint64_t cy1 = min((uint64_t)ceil(regionY1 / R) + 1, (uint64_t)gridHeight);
+    const uint64_t regionCells = (cx1 > cx0) ? cx1 - cx0 : 0;
+
+    vector<const RenderTile*> regionTiles;
+    regionTiles.resize(regionCells * ((cy1 > cy0) ? cy1 - cy0 : 0), nullptr);
+    int lastPalletId = -1;
+    const RenderTile *lastTile = nullptr;
+    for (uint64_t cy = cy0; cy < cy1; cy++){
+        for (uint64_t cx = cx0; cx < cx1; cx++){
+            int palletId = tiles[cy * gridWidth + cx].palletId;
+            if (palletId < 0) continue;
+
+            // Neighbouring cells often share a tile, skip the lookup for those
+            if (palletId != lastPalletId){
+                lastTile = fetchTile(palletId);
+                lastPalletId = palletId;
+                if (lastTile == nullptr) return 1;
+            }
+            regionTiles[(cy - cy0) * regionCells + (cx - cx0)] = lastTile;
+        }
+    }
+
+    auto tileAt = [&](uint64_t cx, uint64_t cy){
+        cx = min(max(cx, cx0), cx1 - 1);
+        cy = min(max(cy, cy0), cy1 - 1);
+        return regionTiles[(cy - cy0) * regionCells + (cx - cx0)];
+    };
+
+    for (unsigned int oy = 0; oy < regionHeight; oy++){
+        for (unsigned int ox = 0; ox < regionWidth; ox++){
+            uint8_t *pixel = out + ((uint64_t)oy * regionWidth + ox) * 4;
+            pixel[0] = pixel[1] = pixel[2] = pixel[3] = 0;
+
+            // Full resolution box covered by this output pixel
+            double X0f = (double)(x + ox) * inverseScale;
+            double Y0f = (double)(y + oy) * inverseScale;
+            double X1f = min((double)(x + ox + 1) * inverseScale, (double)width);
+            double Y1f = min((double)(y + oy + 1) * inverseScale, (double)height);
+
+            if (X0f >= width || Y0f >= height) continue;
+
+            // At full resolution or when scaled up the pixel is copied out of its tile
+            if (scale >= 1.0){
+                uint64_t X = min((uint64_t)(((double)(x + ox) + 0.5) * inverseScale), width - 1);
+                uint64_t Y = min((uint64_t)(((double)(y + oy) + 0.5) * inverseScale), height - 1);
+
+                const RenderTile *tile = tileAt(X / R, Y / R);
+                if (tile == nullptr) continue;
+
+                const uint8_t *tilePixel = &tile->pixels[((Y % R) * R + (X % R)) * 4];
+                for (int c = 0; c < 4; c++) pixel[c] = tilePixel[c];
+                continue;
+            }
+
+            double sum[4] = {0.0, 0.0, 0.0, 0.0};
+            double area;
+
+            if (inverseScale < R){
+                // The box is smaller than a tile, so it spans at most 2x2 tiles.
+                // Snap it to whole pixels and sum the parts of each tile
+                uint64_t X0 = llround(X0f);
+                uint64_t Y0 = llround(Y0f);
+                uint64_t X1 = min(max((uint64_t)llround(X1f), X0 + 1), width);
+                uint64_t Y1 = min(max((uint64_t)llround(Y1f), Y0 + 1), height);
+                if (X0 >= X1 || Y0 >= Y1) continue;
+
+                uint64_t tileSum[4] = {0, 0, 0, 0};
+                for (uint64_t cy = Y0 / R; cy <= (Y1 - 1) / R; cy++){
+                    for (uint64_t cx = X0 / R; cx <= (X1 - 1) / R; cx++){
+                        unsigned int x0 = max(X0, cx * R) - cx * R;
+                        unsigned int y0 = max(Y0, cy * R) - cy * R;
+                        unsigned int x1 = min(X1, (cx + 1) * R) - cx * R;
+                        unsigned int y1 = min(Y1, (cy + 1) * R) - cy * R;
+
+                        sumTileBox(tileAt(cx, cy), x0, y0, x1, y1, tileSum);
+                    }
+                }
+
+                for (int c = 0; c < 4; c++) sum[c] = tileSum[c];
+                area = (double)(X1 - X0) * (Y1 - Y0);
+            }
+            else {
+                // The box covers whole tiles, so add up their average 
+                // colors weighted by how much of each tile is covered
+                double X0c = X0f / R;
+                double Y0c = Y0f / R;
+                double X1c = X1f / R;
+                double Y1c = Y1f / R;
+
+                for (uint64_t cy = (uint64_t)Y0c; cy < Y1c; cy++){
+                    double weightY = min(Y1c, (double)(cy + 1)) - max(Y0c, (double)cy);
+                    for (uint64_t cx = (uint64_t)X0c; cx < X1c; cx++){
+                        const RenderTile *tile = tileAt(cx, cy);
+                        if (tile == nullptr) continue;
+
+                        double weight = weightY * (min(X1c, (double)(cx + 1)) - max(X0c, (double)cx));
+                        for (int c = 0; c < 4; c++) sum[c] += tile->average[c] * weight;
+                    }
+                }
+
+                area = (X1c - X0c) * (Y1c - Y0c);
+            }
+
+            // Undo the premultiplication
+            if (sum[3] <= 0) continue;
+            for (int c = 0; c < 3; c++) pixel[c] = (uint8_t)min(255.0, round(sum[c] * 255.0 / sum[3]));
+            pixel[3] = (uint8_t)min(255.0, round(sum[3] / area));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include "tile.h"
+#include "colors.h"
+#include "pallet.h"
+#include "parallel.h"
+
+using namespace std;
+
+// Decoded pallet tile kept by the renderer
+struct RenderTile{
+    // "tileSize * tileSize" RGBA pixels
+    vector<uint8_t> pixels;
+
+    // Summed-area table of the premultiplied RGBA pixels, "(tileSize + 1)^2 * 4"
+    // values, so any box of the tile can be averaged with 4 lookups
+    vector<uint32_t> sums;
+
+    // Average premultiplied RGBA color of the whole tile
+    double average[4];
+};
+
+// Composes parts of a mosaic straight from the match grid and the pallet 
+// tiles without ever building the full resolution mosaic image. Pallet 
+// tiles are decoded the first time a rendered region touches them
+class MosaicRenderer{
+    public:
+        unsigned int gridWidth;
+        unsigned int gridHeight;
+        unsigned int tileSize;
+
+        // Full resolution size of the mosaic in pixels
+        uint64_t width;
+        uint64_t height;
+
+        // Decodes every pallet tile used by the grid up front, returns "true" on error
+        bool loadTiles(unsigned int threadCount);
+
+        // Renders the "regionWidth x regionHeight" RGBA region at "(x, y)" of the mosaic 
+        // scaled by "scale" into "out", "x" and "y" are in scaled pixels. When scaled down 
+        // every output pixel is the box filtered average of the pixels it covers, when 
+        // scaled up it's the nearest pixel. Only the tiles inside the region get decoded.
+        // Safe to call from several threads at once, returns "true" on error
+        bool renderRegion(uint64_t x, uint64_t y, unsigned int regionWidth, unsigned int regionHeight, double scale, uint8_t *out);
+
+        MosaicRenderer(const vector<Tile> &tiles, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight);
+
+    private:
+        const vector<Tile> &tiles;
+        const Pallet &pallet;
+
+        // Indexed by palletId, every tile is decoded once by whichever 
+        // thread needs it first while the others wait for that one tile
+        vector<RenderTile> loadedTiles;
+        unique_ptr<once_flag[]> tileLoaded;
+        MemoryBudget decodeBudget;
+
+        static bool decodeTile(const Pallet &pallet, int palletId, RenderTile &tile, MemoryBudget *decodeBudget = nullptr);
+
+        // nullptr if the tile couldn't be decoded
+        const RenderTile* loadTile(int palletId);
+
+        const RenderTile* fetchTile(int palletId);
+
+        void sumTileBox(const RenderTile *tile, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, uint64_t *sum);
+};
+
+#endif
@@ -0,0 +1,356 @@
+// Platform headers go first, windows.h breaks after "using namespace std"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#include <cerrno>
+extern char **environ;
+#endif
+
+#include "shards.h"
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include "mosaic.h"
+#include "matcher.h"
+#include "tilestore.h"
+#include "parallel.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+string ShardedRender::shardFilePath(string imageName, unsigned int shardIndex, string extension){
+    return imageName + "_shard" + to_string(shardIndex) + "." + extension;
+}
+
+bool ShardedRender::renderShard(string inputImagePath, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, 
+    unsigned int shardIndex, unsigned int shardCount, unsigned int threadCount, bool silentMode){
+    const unsigned int channels = 4;
+    const unsigned int tileSize = pallet.minResolution;
+
+    TileMatcher matcher(pallet.tiles);
+    TileStore tileStore;
+    tileStore.openLazy(pallet);
+
+    unsigned int firstRow = 0;
+    unsigned int lastRow = 0;
+    vector<Tile> tiles;
+    vector<uint8_t> bandPixels;
+    ofstream band_stream;
+    bool failed = false;
+
+    // Every worker still decodes the whole image, but only its own rows 
+    // of cells are matched, composed and held on to
+    bool result = Mosaic::streamImageCIELABRows(inputImagePath, gridWidth, gridHeight, 64, 
+        [&](unsigned int row, vector<CIELABColor> &rowPixels){
+            if (!band_stream.is_open() && !failed) {
+                firstRow = (uint64_t)shardIndex * Mosaic::imageHeight / shardCount;
+                lastRow = (uint64_t)(shardIndex + 1) * Mosaic::imageHeight / shardCount;
+                tiles.resize((uint64_t)(lastRow - firstRow) * Mosaic::imageWidth);
+                bandPixels.resize((uint64_t)Mosaic::imageWidth * tileSize * tileSize * channels);
+
+                band_stream.open(shardFilePath(Mosaic::imageName, shardIndex, "rgba"), ios::binary);
+                if (!band_stream.is_open()) failed = true;
+            }
+            if (failed || row < firstRow || row >= lastRow) return;
+
+            Tile *rowTiles = tiles.data() + (uint64_t)(row - firstRow) * Mosaic::imageWidth;
+            Parallel::forEach(rowPixels.size(), threadCount, [&](uint64_t x){
+                uint64_t pixelId = (uint64_t)row * Mosaic::imageWidth + x;
+                rowTiles[x] = matcher.match(rowPixels[x], pixelId);
+                rowTiles[x].pixelId = pixelId;
+            });
+
+            if (tileStore.composeRow(rowTiles, Mosaic::imageWidth, bandPixels.data())) {
+                failed = true;
+                return;
+            }
+            band_stream.write((const char*)bandPixels.data(), bandPixels.size());
+            if (!band_stream) failed = true;
+
+            if (!silentMode) cout << "Progress: "
+                << (int)((float)(row + 1 - firstRow) / (float)(lastRow - firstRow) * 100) << "%"
+                << " (" << row + 1 - firstRow << " / " << lastRow - firstRow << ") shard rows rendered\n";
+        }
+    );
+    band_stream.close();
+    if (result || failed) return 1;
+
+    json shard;
+    shard["width"] = Mosaic::imageWidth;
+    shard["height"] = Mosaic::imageHeight;
+    shard["sourceWidth"] = Mosaic::sourceImageWidth;
+    shard["sourceHeight"] = Mosaic::sourceImageHeight;
+    shard["firstRow"] = firstRow;
+    shard["rowCount"] = lastRow - firstRow;
+    shard["palletTileIds"] = json::array();
+    shard["deltaEs"] = json::array();
+    for (const Tile &tile : tiles) {
+        shard["palletTileIds"].push_back(tile.palletId);
+        shard["deltaEs"].push_back(tile.closestDeltaE);
+    }
+
+    ofstream shard_stream(shardFilePath(Mosaic::imageName, shardIndex, "json"));
+    shard_stream << shard.dump();
+    shard_stream.close();
+
+    matcher.printMismatchRate();
+    return !shard_stream;
+}
+
+#ifdef _WIN32
+// Quotes "arg" so the C runtime of the started process splits it back into the 
+// same argument, backslashes only need escaping when they end up before a quote
+static string quoteArgument(const string &arg){
+    if (arg.size() > 0 && arg.find_first_of(" \t\n\v\"") == string::npos) return arg;
+
+    string quoted = "\"";
+    uint64_t backslashes = 0;
+    for (char c : arg){
+        if (c == '\\') {
+            backslashes++;
+            continue;
+        }
+
+        if (c == '"') quoted.append(backslashes * 2 + 1, '\\');
+        else quoted.append(backslashes, '\\');
+        quoted += c;
+        backslashes = 0;
+    }
+    quoted.append(backslashes * 2, '\\');
+    return quoted + "\"";
+}
+
+int ShardedRender::runProcess(const vector<string> &args){
+    // No shell is involved, the command line only has to survive the C runtime's argument parsing
+    string commandLine;
+    for (const string &arg : args) commandLine += (commandLine.size() > 0 ? " " : "") + quoteArgument(arg);
+
+    STARTUPINFOA startupInfo;
+    PROCESS_INFORMATION processInfo;
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    startupInfo.cb = sizeof(startupInfo);
+    if (!CreateProcessA(NULL, commandLine.data(), NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo)) return -1;
+
+    WaitForSingleObject(processInfo.hProcess, INFINITE);
+    DWORD exitCode = (DWORD)-1;
+    GetExitCodeProcess(processInfo.hProcess, &exitCode);
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+    return (int)exitCode;
+}
+#else
+int ShardedRender::runProcess(const vector<string> &args){
+    // The arguments are handed over as they are, no shell ever parses them
+    vector<char*> argv;
+    for (const string &arg : args) argv.push_back((char*)arg.c_str());
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0) return -1;
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
+bool ShardedRender::runWorkers(const vector<string> &workerArgs, string shardOption, unsigned int shardCount){
+    // Every worker is its own process, the threads just wait on them
+    vector<int> exitCodes;
+    exitCodes.resize(shardCount, 0);
+    vector<thread> workers;
+    for (unsigned int shard = 0; shard < shardCount; shard++){
+        workers.emplace_back([&, shard](){
+            vector<string> args = workerArgs;
+            args.push_back(shardOption);
+            args.push_back(to_string(shard) + "/" + to_string(shardCount));
+            exitCodes[shard] = runProcess(args);
+        });
+    }
+    for (thread &worker : workers) worker.join();
+
+    bool result = false;
+    for (unsigned int shard = 0; shard < shardCount; shard++){
+        if (exitCodes[shard] != 0) {
+            cout << "error: Worker for shard " << shard << " failed\n";
+            result = true;
+        }
+    }
+
+    return result;
+}
+
+bool ShardedRender::coordinate(const vector<string> &workerArgs, const Pallet &pallet, unsigned int shardCount, unsigned int threadCount, vector<Tile> &tiles){
+    const unsigned int channels = 4;
+    const unsigned int tileSize = pallet.minResolution;
+
+    bool result = runWorkers(workerArgs, "--shard", shardCount);
+
+    // The bands are copied over a row of tiles at a time, so the 
+    // whole mosaic image is never held in memory here either
+    ImageWriter *writer = nullptr;
+    vector<uint8_t> bandPixels;
+    unsigned int nextRow = 0;
+    for (unsigned int shard = 0; shard < shardCount && !result; shard++){
+        json shardData;
+        try{
+            ifstream shard_stream(shardFilePath(Mosaic::imageName, shard, "json"));
+            shardData = json::parse(shard_stream);
+        } catch(const exception&){
+            cout << "error: Unable to read the manifest of shard " << shard << "\n";
+            result = true;
+            break;
+        }
+
+        if (writer == nullptr) {
+            Mosaic::imageWidth = shardData["width"];
+            Mosaic::imageHeight = shardData["height"];
+            Mosaic::sourceImageWidth = shardData["sourceWidth"];
+            Mosaic::sourceImageHeight = shardData["sourceHeight"];
+            tiles.resize((uint64_t)Mosaic::imageWidth * Mosaic::imageHeight);
+            bandPixels.resize((uint64_t)Mosaic::imageWidth * tileSize * tileSize * channels);
+
+            writer = Mosaic::createImageWriter(threadCount);
+            result = writer->open(Mosaic::imageName + "_mosaic." + Mosaic::imageFormat, 
+                (uint64_t)Mosaic::imageWidth * tileSize, (uint64_t)Mosaic::imageHeight * tileSize, channels);
+            if (result) break;
+        }
+
+        unsigned int firstRow = shardData["firstRow"];
+        unsigned int rowCount = shardData["rowCount"];
+        if (firstRow != nextRow || shardData["palletTileIds"].size() != (uint64_t)rowCount * Mosaic::imageWidth) {
+            cout << "error: Shard " << shard << " doesn't line up with the shards before it\n";
+            result = true;
+            break;
+        }
+
+        for (uint64_t i = 0; i < (uint64_t)rowCount * Mosaic::imageWidth; i++){
+            uint64_t pixelId = (uint64_t)firstRow * Mosaic::imageWidth + i;
+            tiles[pixelId].pixelId = pixelId;
+            tiles[pixelId].palletId = shardData["palletTileIds"][i];
+            tiles[pixelId].closestDeltaE = shardData["deltaEs"][i];
+        }
+
+        ifstream band_stream(shardFilePath(Mosaic::imageName, shard, "rgba"), ios::binary);
+        for (unsigned int row = 0; row < rowCount && !result; row++){
+            band_stream.read((char*)bandPixels.data(), bandPixels.size());
+            result = !band_stream || writer->writeRows(bandPixels.data(), tileSize);
+        }
+        if (result) cout << "error: Unable to stitch the band of shard " << shard << "\n";
+        nextRow += rowCount;
+    }
+
+    if (!result && nextRow != Mosaic::imageHeight) {
+        cout << "error: The shards don't cover the whole mosaic\n";
+        result = true;
+    }
+    if (writer != nullptr) {
+        result = writer->close() || result;
+        delete writer;
+    }
+
+    for (unsigned int shard = 0; shard < shardCount; shard++){
+        error_code ignored;
+        filesystem::remove(shardFilePath(Mosaic::imageName, shard, "rgba"), ignored);
+        filesystem::remove(shardFilePath(Mosaic::imageName, shard, "json"), ignored);
+    }
+
+    return result;
+}
+
+// Every cell's result is stored as its deltaE followed by its palletId
+static const uint64_t matchRecordSize = sizeof(double) + sizeof(int32_t);
+
+bool ShardedRender::matchPalletShard(string inputImagePath, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, 
+    unsigned int shardIndex, unsigned int shardCount, unsigned int threadCount, bool silentMode){
+    const uint64_t firstTile = (uint64_t)shardIndex * pallet.tiles.size() / shardCount;
+    const uint64_t lastTile = (uint64_t)(shardIndex + 1) * pallet.tiles.size() / shardCount;
+    if (firstTile >= lastTile) {
+        cout << "error: Pallet shard " << shardIndex << " has no tiles\n";
+        return 1;
+    }
+
+    // Shards are contiguous, so the lowest palletId in the shard still wins a tie in it
+    // Variants are picked once the shards are reduced
+    vector<palletTile> palletTiles(pallet.tiles.begin() + firstTile, pallet.tiles.begin() + lastTile);
+    for (palletTile &tile : palletTiles) tile.variantIds.clear();
+    vector<Tile> tiles = Mosaic::matchImageFused(inputImagePath, palletTiles, gridWidth, gridHeight, threadCount, silentMode);
+    if (tiles.size() < 1) return 1;
+
+    ofstream match_stream(shardFilePath(Mosaic::imageName + "_pallet", shardIndex, "bin"), ios::binary);
+    uint32_t header[4] = {Mosaic::imageWidth, Mosaic::imageHeight, Mosaic::sourceImageWidth, Mosaic::sourceImageHeight};
+    match_stream.write((const char*)header, sizeof(header));
+
+    vector<uint8_t> records;
+    records.resize(tiles.size() * matchRecordSize);
+    for (uint64_t i = 0; i < tiles.size(); i++){
+        int32_t palletId = (tiles[i].palletId >= 0) ? (int32_t)(tiles[i].palletId + firstTile) : -1;
+        memcpy(records.data() + i * matchRecordSize, &tiles[i].closestDeltaE, sizeof(double));
+        memcpy(records.data() + i * matchRecordSize + sizeof(double), &palletId, sizeof(int32_t));
+    }
+    match_stream.write((const char*)records.data(), records.size());
+    match_stream.close();
+
+    return !match_stream;
+}
+
+vector<Tile> ShardedRender::matchPalletSharded(const vector<string> &workerArgs, const Pallet &pallet, unsigned int shardCount){
+    vector<Tile> tiles;
+    bool result = runWorkers(workerArgs, "--pallet-shard", shardCount);
+
+    // Shards are reduced in palletId order, so a later shard only 
+    // wins a cell with a strictly closer tile
+    vector<uint8_t> records;
+    for (unsigned int shard = 0; shard < shardCount && !result; shard++){
+        ifstream match_stream(shardFilePath(Mosaic::imageName + "_pallet", shard, "bin"), ios::binary);
+        uint32_t header[4];
+        match_stream.read((char*)header, sizeof(header));
+
+        if (shard == 0 && match_stream) {
+            Mosaic::imageWidth = header[0];
+            Mosaic::imageHeight = header[1];
+            Mosaic::sourceImageWidth = header[2];
+            Mosaic::sourceImageHeight = header[3];
+            tiles.resize((uint64_t)Mosaic::imageWidth * Mosaic::imageHeight);
+        }
+
+        records.resize(tiles.size() * matchRecordSize);
+        match_stream.read((char*)records.data(), records.size());
+        if (!match_stream || header[0] != Mosaic::imageWidth || header[1] != Mosaic::imageHeight) {
+            cout << "error: Unable to read the matches of pallet shard " << shard << "\n";
+            result = true;
+            break;
+        }
+
+        for (uint64_t i = 0; i < tiles.size(); i++){
+            double deltaE;
+            int32_t palletId;
+            memcpy(&deltaE, records.data() + i * matchRecordSize, sizeof(double));
+            memcpy(&palletId, records.data() + i * matchRecordSize + sizeof(double), sizeof(int32_t));
+
+            if (shard == 0 || deltaE < tiles[i].closestDeltaE) {
+                tiles[i].pixelId = i;
+                tiles[i].palletId = palletId;
+                tiles[i].closestDeltaE = deltaE;
+            }
+        }
+    }
+
+    for (unsigned int shard = 0; shard < shardCount; shard++){
+        error_code ignored;
+        filesystem::remove(shardFilePath(Mosaic::imageName + "_pallet", shard, "bin"), ignored);
+    }
+
+    if (result) tiles.clear();
+    for (Tile &tile : tiles) tile.palletId = Pallet::pickVariant(pallet.tiles, tile.palletId, tile.pixelId);
+
+    return tiles;
+}
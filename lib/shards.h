@@ -0,0 +1,56 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include "tile.h"
+#include "pallet.h"
+
+using namespace std;
+
+// Renders the mosaic with several worker processes. The grid is split 
+// into "shardCount" bands of whole rows, every worker matches and composes 
+// its band into "<image name>_shard<index>.rgba" with the band's matches 
+// in "<image name>_shard<index>.json", and the coordinator stitches the 
+// bands into the mosaic image file once every worker is done. For pallets 
+// too big for one process the pallet can be split across workers instead, 
+// every worker then matches the whole grid against its part of the pallet
+class ShardedRender{
+    public:
+        // Worker side, renders band "shardIndex" of "shardCount". Returns "true" on error
+        static bool renderShard(string inputImagePath, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, 
+            unsigned int shardIndex, unsigned int shardCount, unsigned int threadCount, bool silentMode);
+
+        // Coordinator side, runs the worker command line "workerArgs" with "--shard <index>/<shardCount>" 
+        // appended for every shard at once and stitches their bands. "tiles" gets 
+        // every cell's match for the manifest, returns "true" on error
+        static bool coordinate(const vector<string> &workerArgs, const Pallet &pallet, unsigned int shardCount, unsigned int threadCount, vector<Tile> &tiles);
+
+        // Worker side of pallet sharding, matches every cell against pallet tiles 
+        // [shardIndex * size / shardCount, (shardIndex + 1) * size / shardCount) and 
+        // writes the best (deltaE, palletId) of every cell to 
+        // "<image name>_pallet_shard<index>.bin". Returns "true" on error
+        static bool matchPalletShard(string inputImagePath, const Pallet &pallet, unsigned int gridWidth, unsigned int gridHeight, 
+            unsigned int shardIndex, unsigned int shardCount, unsigned int threadCount, bool silentMode);
+
+        // Coordinator side of pallet sharding, runs "workerArgs" with "--pallet-shard <index>/<shardCount>" 
+        // appended for every shard at once and keeps the closest tile of every cell, ties going to the 
+        // lowest palletId just like a single process would. Empty on error
+        static vector<Tile> matchPalletSharded(const vector<string> &workerArgs, const Pallet &pallet, unsigned int shardCount);
+
+        static string shardFilePath(string imageName, unsigned int shardIndex, string extension);
+
+    private:
+        // Runs "workerArgs" with "<shardOption> <index>/<shardCount>" appended for 
+        // every shard at once, returns "true" if any worker failed
+        static bool runWorkers(const vector<string> &workerArgs, string shardOption, unsigned int shardCount);
+
+        // Starts "args[0]" (searched for in the PATH like a shell would) with "args" as 
+        // its arguments and waits for it, no shell is involved so nothing in them is 
+        // ever interpreted. Returns the exit code, -1 if it couldn't be started
+        static int runProcess(const vector<string> &args);
+};
+
+#endif
@@ -7,6 +7,11 @@ struct Tile{
     int pixelId;
     int palletId;
     double closestDeltaE = 9007199254740991;
+
+    // Side in grid cells of the square block this tile covers in adaptive 
+    // mosaics, blocks start at multiples of their size and every cell of 
+    // a block holds the same tile
+    unsigned int blockSize = 1;
 };
 
 #endif
\ No newline at end of file
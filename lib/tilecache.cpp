@@ -0,0 +1,143 @@
+// Platform headers go first, windows.h breaks after "using namespace std"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "tilecache.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <cstring>
+
+using namespace std::filesystem;
+
+string TileCache::cacheDirPath = "";
+atomic<uint64_t> TileCache::hits(0);
+atomic<uint64_t> TileCache::misses(0);
+
+namespace {
+    const char CACHE_MAGIC[4] = {'T', 'M', 'T', 'C'};
+    const uint32_t CACHE_VERSION = 1;
+}
+
+static uint64_t processId(){
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+int64_t TileCache::modificationTime(string tilePath_abs){
+    return last_write_time(path(tilePath_abs)).time_since_epoch().count();
+}
+
+string TileCache::entryPath(string tilePath_abs, unsigned int tileSize){
+    // FNV-1a hash of the path, the full path is stored in the 
+    // entry as well so colliding hashes are still told apart
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t i = 0; i < tilePath_abs.size(); i++){
+        hash ^= (uint8_t)tilePath_abs[i];
+        hash *= 1099511628211ull;
+    }
+
+    char hashString[17];
+    snprintf(hashString, sizeof(hashString), "%016llx", (unsigned long long)hash);
+
+    string dirPath = cacheDirPath;
+    if (dirPath.back() != '/' && dirPath.back() != '\\') dirPath += "/";
+
+    return dirPath + hashString + "_" + to_string(tileSize) + ".tile";
+}
+
+bool TileCache::load(string tilePath, unsigned int tileSize, vector<uint8_t> &pixels){
+    if (cacheDirPath == "") return 1;
+
+    try{
+        string tilePath_abs = canonical(path(tilePath)).string();
+
+        ifstream entry_stream(entryPath(tilePath_abs, tileSize), ios::binary);
+        if (!entry_stream.is_open()) {
+            misses++;
+            return 1;
+        }
+
+        // Header: magic, version, modification time, tile size, path length and path
+        char magic[4];
+        uint32_t version;
+        int64_t mtime;
+        uint32_t size;
+        uint32_t pathLength;
+        entry_stream.read(magic, 4);
+        entry_stream.read((char*)&version, sizeof(version));
+        entry_stream.read((char*)&mtime, sizeof(mtime));
+        entry_stream.read((char*)&size, sizeof(size));
+        entry_stream.read((char*)&pathLength, sizeof(pathLength));
+
+        if (!entry_stream || memcmp(magic, CACHE_MAGIC, 4) != 0 || version != CACHE_VERSION 
+            || mtime != modificationTime(tilePath_abs) || size != tileSize || pathLength != tilePath_abs.size()) {
+            misses++;
+            return 1;
+        }
+
+        string entryTilePath;
+        entryTilePath.resize(pathLength);
+        entry_stream.read(&entryTilePath[0], pathLength);
+
+        pixels.resize((uint64_t)tileSize * tileSize * 4);
+        entry_stream.read((char*)pixels.data(), pixels.size());
+
+        if (!entry_stream || entryTilePath != tilePath_abs) {
+            misses++;
+            return 1;
+        }
+    } catch(const exception&){
+        misses++;
+        return 1;
+    }
+
+    hits++;
+    return 0;
+}
+
+void TileCache::store(string tilePath, unsigned int tileSize, const vector<uint8_t> &pixels){
+    if (cacheDirPath == "") return;
+
+    try{
+        string tilePath_abs = canonical(path(tilePath)).string();
+        string entry = entryPath(tilePath_abs, tileSize);
+        create_directories(path(cacheDirPath));
+
+        // Written under a temporary name and then renamed so other threads 
+        // and processes never read a half written entry, thread id hashes 
+        // repeat across processes so the name carries the process id too
+        string tempEntry = entry + "." + to_string(processId()) + "." + to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+        ofstream entry_stream(tempEntry, ios::binary);
+        if (!entry_stream.is_open()) return;
+
+        int64_t mtime = modificationTime(tilePath_abs);
+        uint32_t size = tileSize;
+        uint32_t pathLength = tilePath_abs.size();
+        entry_stream.write(CACHE_MAGIC, 4);
+        entry_stream.write((const char*)&CACHE_VERSION, sizeof(CACHE_VERSION));
+        entry_stream.write((const char*)&mtime, sizeof(mtime));
+        entry_stream.write((const char*)&size, sizeof(size));
+        entry_stream.write((const char*)&pathLength, sizeof(pathLength));
+        entry_stream.write(tilePath_abs.data(), pathLength);
+        entry_stream.write((const char*)pixels.data(), pixels.size());
+        entry_stream.close();
+
+        if (!entry_stream) {
+            remove(path(tempEntry));
+            return;
+        }
+        rename(path(tempEntry), path(entry));
+    } catch(const exception&){
+        // A tile that can't be cached is simply decoded again next time
+        return;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+// On-disk cache of decoded pallet tiles that were scaled to the pallet's 
+// tile size. Entries are keyed by the tile image's path, its modification 
+// time and the tile size, so an edited image or a different pallet 
+// resolution never reads a stale entry
+class TileCache{
+    public:
+        // Directory the cache entries are kept in, caching is off while it's empty
+        static string cacheDirPath;
+
+        static atomic<uint64_t> hits;
+        static atomic<uint64_t> misses;
+
+        // Reads the "tileSize x tileSize" RGBA pixels of the tile image at "tilePath",
+        // returns "true" if there is no valid entry for it
+        static bool load(string tilePath, unsigned int tileSize, vector<uint8_t> &pixels);
+
+        // Stores the "tileSize x tileSize" RGBA pixels of the tile image at "tilePath"
+        static void store(string tilePath, unsigned int tileSize, const vector<uint8_t> &pixels);
+
+    private:
+        static string entryPath(string tilePath_abs, unsigned int tileSize);
+
+        static int64_t modificationTime(string tilePath_abs);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "tilestore.h"
+#include <atomic>
+#include <cstring>
+#include "mosaic.h"
+#include "parallel.h"
+
+TileStore::TileStore() : decodeBudget(0){
+    tileSize = 0;
+    pallet = nullptr;
+    lazy = false;
+}
+
+vector<int> TileStore::usedPalletIds(const vector<Tile> &tiles, uint64_t palletSize, unsigned int blockSize){
+    vector<int> palletIds;
+    vector<bool> used;
+    used.resize(palletSize, false);
+
+    for (uint64_t i = 0; i < tiles.size(); i++){
+        int palletId = tiles[i].palletId;
+        if (palletId < 0 || used[palletId] || (blockSize > 0 && tiles[i].blockSize != blockSize)) continue;
+        used[palletId] = true;
+        palletIds.push_back(palletId);
+    }
+
+    return palletIds;
+}
+
+bool TileStore::load(const vector<Tile> &tiles, const Pallet &pallet, unsigned int threadCount, unsigned int blockSize){
+    lazy = false;
+    tileSize = pallet.minResolution * blockSize;
+    const uint64_t tileBytes = (uint64_t)tileSize * tileSize * 4;
+
+    vector<int> palletIds = usedPalletIds(tiles, pallet.tileCount(), blockSize);
+
+    // Slot 0 of the arena is the transparent tile, every used tile gets the next one
+    arena.assign((palletIds.size() + 1) * tileBytes, 0);
+    tilePixels.assign(pallet.tileCount() + 1, nullptr);
+    tilePixels[0] = arena.data();
+
+    // Source pallet images can be far bigger than the tiles they're scaled 
+    // down to, so the decodes running at once share a memory budget
+    atomic<bool> failed(false);
+    decodeBudget.limit = Mosaic::tileDecodeMemory;
+
+    Parallel::forEach(palletIds.size(), threadCount, [&](uint64_t i){
+        vector<uint8_t> pixels = Mosaic::fetchPalletTilePixels(pallet, palletIds[i], &decodeBudget, tileSize);
+        if (pixels.size() < tileBytes) {
+            failed = true;
+            return;
+        }
+
+        memcpy(arena.data() + (i + 1) * tileBytes, pixels.data(), tileBytes);
+    });
+
+    if (failed) {
+        cout << "error: Unable to load pallet image file\n";
+        return 1;
+    }
+
+    for (uint64_t i = 0; i < palletIds.size(); i++){
+        tilePixels[palletIds[i] + 1] = arena.data() + (i + 1) * tileBytes;
+    }
+
+    return 0;
+}
+
+void TileStore::openLazy(const Pallet &pallet){
+    this->pallet = &pallet;
+    lazy = true;
+    tileSize = pallet.minResolution;
+    decodeBudget.limit = Mosaic::tileDecodeMemory;
+
+    // Every tile gets its own buffer since they're decoded in whatever order they're needed
+    lazyTiles.clear();
+    lazyTiles.resize(pallet.tileCount() + 1);
+    lazyTiles[0].assign((uint64_t)tileSize * tileSize * 4, 0);
+    lazyLoaded.reset(new once_flag[pallet.tileCount() + 1]);
+
+    tilePixels.assign(pallet.tileCount() + 1, nullptr);
+    tilePixels[0] = lazyTiles[0].data();
+}
+
+const uint8_t* TileStore::fetch(int palletId){
+    if (!lazy || palletId < 0) return pixels(palletId);
+
+    // Threads asking for a tile that's being decoded wait for it instead of decoding it again
+    call_once(lazyLoaded[palletId + 1], [&](){
+        vector<uint8_t> tilePixels_RGBA = Mosaic::fetchPalletTilePixels(*pallet, palletId, &decodeBudget);
+        if (tilePixels_RGBA.size() < (uint64_t)tileSize * tileSize * 4) return;
+
+        lazyTiles[palletId + 1] = move(tilePixels_RGBA);
+        tilePixels[palletId + 1] = lazyTiles[palletId + 1].data();
+    });
+
+    return tilePixels[palletId + 1];
+}
+
+bool TileStore::composeRow(const Tile *rowTiles, unsigned int gridWidth, uint8_t *out){
+    const uint64_t tileRowBytes = (uint64_t)tileSize * 4;
+    const uint64_t rowBytes = (uint64_t)gridWidth * tileRowBytes;
+
+    for (unsigned int i = 0; i < gridWidth; i++){
+        const uint8_t *tile = fetch(rowTiles[i].palletId);
+        if (tile == nullptr) {
+            cout << "error: Unable to load pallet image file\n";
+            return 1;
+        }
+
+        for (unsigned int y = 0; y < tileSize; y++){
+            memcpy(out + y * rowBytes + i * tileRowBytes, tile + y * tileRowBytes, tileRowBytes);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef TILESTORE_H
+#define TILESTORE_H
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "tile.h"
+#include "pallet.h"
+#include "parallel.h"
+
+using namespace std;
+
+// Decoded pallet tiles packed into one contiguous arena of RGBA pixels 
+// with a dense table of pointers into it indexed by palletId, so fetching 
+// a tile's pixels is a single load instead of a tree lookup and a copy
+class TileStore{
+    public:
+        unsigned int tileSize;
+
+        // Decodes exactly the pallet tiles used by "tiles" with the given block size in parallel, 
+        // scaled to cover the whole block. Returns "true" on error
+        bool load(const vector<Tile> &tiles, const Pallet &pallet, unsigned int threadCount, unsigned int blockSize = 1);
+
+        // "tileSize * tileSize" RGBA pixels of a pallet tile, palletId -1 is 
+        // the fully transparent tile. nullptr for tiles that weren't loaded
+        inline const uint8_t* pixels(int palletId) const {
+            return tilePixels[palletId + 1];
+        }
+
+        // Decodes tiles the first time they're fetched instead, for when 
+        // the used tiles aren't known before composing starts
+        void openLazy(const Pallet &pallet);
+
+        // Same as "pixels", but in lazy mode the tile is decoded first if it 
+        // isn't yet. Safe to call from several threads at once, nullptr if 
+        // the tile couldn't be loaded
+        const uint8_t* fetch(int palletId);
+
+        // Composes a row of "gridWidth" tiles into "tileSize" rows of RGBA pixels, returns "true" on error
+        bool composeRow(const Tile *rowTiles, unsigned int gridWidth, uint8_t *out);
+
+        // Unique palletIds used by "tiles" in the order they first appear, 
+        // only by tiles of "blockSize" blocks unless it's 0
+        static vector<int> usedPalletIds(const vector<Tile> &tiles, uint64_t palletSize, unsigned int blockSize = 0);
+
+        TileStore();
+
+    private:
+        vector<uint8_t> arena;
+        vector<const uint8_t*> tilePixels;
+
+        const Pallet *pallet;
+        bool lazy;
+        vector<vector<uint8_t>> lazyTiles;
+        unique_ptr<once_flag[]> lazyLoaded;
+        MemoryBudget decodeBudget;
+};
+
+#endif
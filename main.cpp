@@ -6,6 +6,16 @@
 #include "lib/mosaic.h"
 #include "lib/pallet.h"
 #include "lib/tile.h"
+#include "lib/parallel.h"
+#include "lib/tilecache.h"
+#include "lib/matcher.h"
+#include "lib/assigner.h"
+#include "lib/dither.h"
+#include "lib/pipeline.h"
+#include "lib/quadtree.h"
+#include "lib/frames.h"
+#include "lib/incremental.h"
+#include "lib/shards.h"
 
 using namespace std;
 using namespace std::filesystem;
@@ -28,57 +38,557 @@ int main(int argc, char *argv[]) {
     string inputImagePath = "";
     string palletFilePath = "pallet.json";
     bool silentMode = false;
+    unsigned int gridWidth = 0;
+    unsigned int gridHeight = 0;
+    bool streamMode = false;
+    bool pipelineMode = false;
+    bool frameMode = false;
+    string previousImagePath = "";
+    string previousManifestPath = "";
+    unsigned int workerCount = 0;
+    unsigned int shardIndex = 0;
+    unsigned int shardCount = 0;
+    unsigned int palletWorkerCount = 0;
+    unsigned int palletShardIndex = 0;
+    unsigned int palletShardCount = 0;
+    vector<string> workerArgs;
+    unsigned int bandHeight = 64;
+    string outputFormat = "png";
+    unsigned int pyramidTileSize = 256;
+    unsigned int threadCount = Parallel::defaultThreadCount();
+    bool regionMode = false;
+    uint64_t regionX = 0;
+    uint64_t regionY = 0;
+    unsigned int regionWidth = 0;
+    unsigned int regionHeight = 0;
+    double regionScale = 1.0;
 
 
     
+    // Workers of a sharded render get every argument as it was given, except for the worker count
+    for (int i = 1; i < argc; i++){
+        if ((string)argv[i] == "--workers" || (string)argv[i] == "--pallet-workers") i++;
+        else workerArgs.push_back(argv[i]);
+    }
+
     // Parse the input args
     for (int i = 1; i < argc; i++){
         string arg = (string)*(argv + i);
         
         string arg_next = (i + 1 >= argc) ? "" : (string)*(argv + (i + 1)); // Checks if next arg exists
 
-        switch (arg){
-            case "--pallet-path":
-            case "-p":
-                if (arg_next == "") {
-                    cout << "error: Undefined pallet file path!\n";
+        if (arg == "--pallet-path" || arg == "-p"){
+            if (arg_next == "") {
+                cout << "error: Undefined pallet file path!\n";
+                return 0;
+            }
+
+            if(endsWith(arg_next, ".json")) {
+                try{
+                    palletFilePath = absolute(relative(path(arg_next))).string();
+                } catch(const exception&){
+                    cout << "error: Missing pallet file or invalid path!\n";
                     return 0;
                 }
+            } else {
+                cout << "error: File must be \".json\"!\n";
+                return 0;
+            }
+            
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--grid" || arg == "-g"){
+            // Expected format is "<width>x<height>", e.g. "200x150"
+            size_t separator = arg_next.find('x');
+            try{
+                if (separator == string::npos) throw invalid_argument(arg_next);
+                gridWidth = stoul(arg_next.substr(0, separator));
+                gridHeight = stoul(arg_next.substr(separator + 1));
+            } catch(const exception&){
+                cout << "error: Grid size must be formatted as \"<width>x<height>\"!\n";
+                return 0;
+            }
 
-                if(endsWith(arg_next, ".json")) {
-                    try{
-                        palletFilePath = absolute(relative(path(arg_next))).string();
-                    } catch(exception){
-                        cout << "error: Missing pallet file or invalid path!\n";
-                        return 0;
-                    }
-                } else {
-                    cout << "error: File must be \".json\"!\n";
-                    return 0;
+            if (gridWidth < 1 || gridHeight < 1) {
+                cout << "error: Grid size must be at least 1x1!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--cells-per-row"){
+            try{
+                gridWidth = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid cells per row count!\n";
+                return 0;
+            }
+            gridHeight = 0; // derived from the image's aspect ratio
+
+            if (gridWidth < 1) {
+                cout << "error: Cells per row must be at least 1!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--stream"){
+            streamMode = true;
+        }
+        else if (arg == "--pipeline"){
+            pipelineMode = true;
+        }
+        else if (arg == "--frames"){
+            // The input path is a numbered frame pattern like "frames/frame_%04d.png"
+            frameMode = true;
+        }
+        else if (arg == "--frame-threshold"){
+            try{
+                FrameSequence::reuseDeltaE = stod(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid frame threshold!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--previous"){
+            // Input image of the run being updated, its mosaic and manifest are looked up by its name
+            try{
+                previousImagePath = absolute(relative(path(arg_next))).string();
+            } catch(const exception&){
+                cout << "error: Missing previous input image file or invalid path!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--previous-manifest"){
+            if (!endsWith(arg_next, ".json")) {
+                cout << "error: Previous manifest must be \".json\"!\n";
+                return 0;
+            }
+            previousManifestPath = arg_next;
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--workers"){
+            try{
+                workerCount = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid worker count!\n";
+                return 0;
+            }
+
+            if (workerCount < 1) {
+                cout << "error: Worker count must be at least 1!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--shard"){
+            // Expected format is "<index>/<count>", e.g. "2/4"
+            size_t separator = arg_next.find('/');
+            try{
+                if (separator == string::npos) throw invalid_argument(arg_next);
+                shardIndex = stoul(arg_next.substr(0, separator));
+                shardCount = stoul(arg_next.substr(separator + 1));
+            } catch(const exception&){
+                cout << "error: Shard must be formatted as \"<index>/<count>\"!\n";
+                return 0;
+            }
+
+            if (shardCount < 1 || shardIndex >= shardCount) {
+                cout << "error: Shard index must be below the shard count!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--pallet-workers"){
+            try{
+                palletWorkerCount = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid pallet worker count!\n";
+                return 0;
+            }
+
+            if (palletWorkerCount < 1) {
+                cout << "error: Pallet worker count must be at least 1!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--pallet-shard"){
+            // Expected format is "<index>/<count>", e.g. "2/4"
+            size_t separator = arg_next.find('/');
+            try{
+                if (separator == string::npos) throw invalid_argument(arg_next);
+                palletShardIndex = stoul(arg_next.substr(0, separator));
+                palletShardCount = stoul(arg_next.substr(separator + 1));
+            } catch(const exception&){
+                cout << "error: Pallet shard must be formatted as \"<index>/<count>\"!\n";
+                return 0;
+            }
+
+            if (palletShardCount < 1 || palletShardIndex >= palletShardCount) {
+                cout << "error: Pallet shard index must be below the pallet shard count!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--band-height"){
+            try{
+                bandHeight = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid band height!\n";
+                return 0;
+            }
+
+            if (bandHeight < 1) {
+                cout << "error: Band height must be at least 1 row!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--output-format" || arg == "-f"){
+            if (arg_next != "png" && arg_next != "qoi" && arg_next != "ppm" && arg_next != "pam" && arg_next != "rgba" && arg_next != "dzi") {
+                cout << "error: Output format must be \"png\", \"qoi\", \"ppm\", \"pam\", \"rgba\" or \"dzi\"!\n";
+                return 0;
+            }
+            outputFormat = arg_next;
+            if (outputFormat != "dzi") Mosaic::imageFormat = outputFormat;
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--tile-size"){
+            try{
+                pyramidTileSize = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid pyramid tile size!\n";
+                return 0;
+            }
+
+            if (pyramidTileSize < 1) {
+                cout << "error: Pyramid tile size must be at least 1px!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--region"){
+            // Expected format is "<x>,<y>,<width>,<height>" in scaled pixels
+            try{
+                size_t pos = 0;
+                size_t next;
+                unsigned long long values[4];
+                for (int v = 0; v < 4; v++){
+                    next = (v < 3) ? arg_next.find(',', pos) : arg_next.size();
+                    if (next == string::npos) throw invalid_argument(arg_next);
+                    values[v] = stoull(arg_next.substr(pos, next - pos));
+                    pos = next + 1;
                 }
-                
-                i++; // skip over next argument because it's a parameter 
-                break;
-
-            case "--silent":
-            case "-s":
-                silentMode = true;
-                break;
-
-            default:
-                if (inputImagePath == "") { // input image path
-                    try{
-                        inputImagePath = absolute(relative(path(arg))).string();
-                    } catch(exception){
-                        cout << "error: Missing input image file or invalid path!\n";
-                        return 0;
-                    }
+                regionX = values[0];
+                regionY = values[1];
+                regionWidth = values[2];
+                regionHeight = values[3];
+            } catch(const exception&){
+                cout << "error: Region must be formatted as \"<x>,<y>,<width>,<height>\"!\n";
+                return 0;
+            }
+            regionMode = true;
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--scale"){
+            try{
+                regionScale = stod(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid scale!\n";
+                return 0;
+            }
+
+            if (regionScale <= 0) {
+                cout << "error: Scale must be above 0!\n";
+                return 0;
+            }
+            regionMode = true;
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--compression-level" || arg == "-c"){
+            try{
+                Mosaic::pngCompressionLevel = stoi(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid compression level!\n";
+                return 0;
+            }
+
+            if (Mosaic::pngCompressionLevel < 0 || Mosaic::pngCompressionLevel > 9) {
+                cout << "error: Compression level must be between 0 (store) and 9!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--png-filter"){
+            if (PNGWriter::parseFilter(arg_next, &Mosaic::pngFilter)) {
+                cout << "error: PNG filter must be \"none\", \"sub\", \"up\", \"average\", \"paeth\" or \"adaptive\"!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--tile-cache"){
+            if (arg_next == "") {
+                cout << "error: Undefined tile cache directory path!\n";
+                return 0;
+            }
+            TileCache::cacheDirPath = arg_next;
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--metric"){
+            if (Colors::parseDeltaEMetric(arg_next, &TileMatcher::metric)) {
+                cout << "error: Metric must be \"cie76\", \"cie94\" or \"ciede2000\"!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--dither"){
+            if (Dither::parseMode(arg_next, &Dither::mode)) {
+                cout << "error: Dither mode must be \"none\", \"floyd-steinberg\" or \"atkinson\"!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--adaptive"){
+            // Biggest block side in cells
+            try{
+                AdaptiveGrid::maxBlockSize = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid adaptive block size!\n";
+                return 0;
+            }
+
+            if (AdaptiveGrid::maxBlockSize < 2 || (AdaptiveGrid::maxBlockSize & (AdaptiveGrid::maxBlockSize - 1)) != 0) {
+                cout << "error: Adaptive block size must be a power of two of at least 2!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--adaptive-threshold"){
+            try{
+                AdaptiveGrid::maxDeltaE = stod(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid adaptive threshold!\n";
+                return 0;
+            }
+
+            if (AdaptiveGrid::maxDeltaE < 0) {
+                cout << "error: Adaptive threshold can't be negative!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--clusters"){
+            // Clusters pallets without any in their file get on load
+            try{
+                Pallet::clusterCount = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid cluster count!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--max-uses"){
+            try{
+                TileAssigner::maxUses = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid max uses per tile!\n";
+                return 0;
+            }
+
+            if (TileAssigner::maxUses < 1) {
+                cout << "error: Max uses per tile must be at least 1!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--min-repeat-distance"){
+            // In grid cells
+            try{
+                TileAssigner::minRepeatDistance = stod(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid minimum repeat distance!\n";
+                return 0;
+            }
+
+            if (TileAssigner::minRepeatDistance < 0) {
+                cout << "error: Minimum repeat distance can't be negative!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--approximate"){
+            // Largest extra deltaE a match may be off from the closest tile by
+            try{
+                TileMatcher::maxExtraDeltaE = stod(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid approximate match error!\n";
+                return 0;
+            }
+
+            if (TileMatcher::maxExtraDeltaE < 0) {
+                cout << "error: Approximate match error can't be negative!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--decode-memory"){
+            // Given in megabytes
+            try{
+                Mosaic::tileDecodeMemory = (uint64_t)stoull(arg_next) << 20;
+            } catch(const exception&){
+                cout << "error: Undefined or invalid decode memory!\n";
+                return 0;
+            }
+
+            if (Mosaic::tileDecodeMemory < 1) {
+                cout << "error: Decode memory must be at least 1 MB!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--band-buffers"){
+            try{
+                Mosaic::outputBandBuffers = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid output band buffer count!\n";
+                return 0;
+            }
+
+            if (Mosaic::outputBandBuffers < 2) {
+                cout << "error: At least 2 output band buffers are needed!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter
+        }
+        else if (arg == "--mmap"){
+            Mosaic::mapOutputFile = true;
+        }
+        else if (arg == "--threads" || arg == "-t"){
+            try{
+                threadCount = stoul(arg_next);
+            } catch(const exception&){
+                cout << "error: Undefined or invalid thread count!\n";
+                return 0;
+            }
+
+            if (threadCount < 1) {
+                cout << "error: Thread count must be at least 1!\n";
+                return 0;
+            }
+
+            i++; // skip over next argument because it's a parameter 
+        }
+        else if (arg == "--silent" || arg == "-s"){
+            silentMode = true;
+        }
+        else{
+            if (inputImagePath == "" && arg.find('%') != string::npos) { // frame pattern, names no file itself
+                inputImagePath = arg;
+            }
+            else if (inputImagePath == "") { // input image path
+                try{
+                    inputImagePath = absolute(relative(path(arg))).string();
+                } catch(const exception&){
+                    cout << "error: Missing input image file or invalid path!\n";
+                    return 0;
                 }
+            }
         }
     }
 
 
 
+    if (Mosaic::mapOutputFile && outputFormat != "rgba" && outputFormat != "pam") {
+        cout << "error: \"--mmap\" only works with the \"rgba\" and \"pam\" output formats!\n";
+        return 0;
+    }
+
+    // The repetition limits need every cell's color at once
+    if (streamMode && TileAssigner::enabled()) {
+        cout << "error: \"--max-uses\" and \"--min-repeat-distance\" can't be used with \"--stream\"!\n";
+        return 0;
+    }
+
+    if (Dither::mode != DITHER_NONE && (streamMode || TileAssigner::enabled())) {
+        cout << "error: \"--dither\" can't be used with \"--stream\" or the repetition limits!\n";
+        return 0;
+    }
+
+    // Pallet shards have to match exactly for the reduced result to be the single process one
+    if ((palletWorkerCount > 0 || palletShardCount > 0) && (streamMode || pipelineMode || frameMode || previousImagePath != "" || workerCount > 0 || shardCount > 0 
+        || Dither::mode != DITHER_NONE || TileAssigner::enabled() || AdaptiveGrid::enabled() || TileMatcher::maxExtraDeltaE >= 0)) {
+        cout << "error: \"--pallet-workers\" can't be used with \"--stream\", \"--pipeline\", \"--frames\", \"--previous\", \"--workers\", \"--dither\", \"--adaptive\", \"--approximate\" or the repetition limits!\n";
+        return 0;
+    }
+
+    // Shards are bands of whole rows stitched into a plain image file
+    if ((workerCount > 0 || shardCount > 0) && (pipelineMode || frameMode || previousImagePath != "" || Dither::mode != DITHER_NONE || TileAssigner::enabled() || AdaptiveGrid::enabled() || regionMode || outputFormat == "dzi" || Mosaic::mapOutputFile)) {
+        cout << "error: \"--workers\" can't be used with \"--pipeline\", \"--frames\", \"--previous\", \"--dither\", \"--adaptive\", the repetition limits, \"--region\", \"--mmap\" or the \"dzi\" output format!\n";
+        return 0;
+    }
+
+    // Only cells are diffed, so every other mode's output can't be patched
+    if (previousImagePath != "" && (streamMode || pipelineMode || frameMode || Dither::mode != DITHER_NONE || TileAssigner::enabled() || AdaptiveGrid::enabled() || regionMode || outputFormat == "dzi" || Mosaic::mapOutputFile)) {
+        cout << "error: \"--previous\" can't be used with \"--stream\", \"--pipeline\", \"--frames\", \"--dither\", \"--adaptive\", the repetition limits, \"--region\", \"--mmap\" or the \"dzi\" output format!\n";
+        return 0;
+    }
+
+    if (previousImagePath != "" && previousManifestPath == "") {
+        Mosaic::setImageName(previousImagePath);
+        previousManifestPath = Mosaic::imageName + "_mosiac.json";
+    }
+
+    // Every frame is matched on the grid and written as a plain image file
+    if (frameMode && (streamMode || pipelineMode || Dither::mode != DITHER_NONE || TileAssigner::enabled() || AdaptiveGrid::enabled() || regionMode || outputFormat == "dzi" || Mosaic::mapOutputFile)) {
+        cout << "error: \"--frames\" can't be used with \"--stream\", \"--pipeline\", \"--dither\", \"--adaptive\", the repetition limits, \"--region\", \"--mmap\" or the \"dzi\" output format!\n";
+        return 0;
+    }
+
+    if (frameMode && inputImagePath.find('%') == string::npos) {
+        cout << "error: Frame paths must have a \"%d\" or \"%0Nd\" for the frame number!\n";
+        return 0;
+    }
+
+    // Blocks are matched as a whole and only the plain image file composes them
+    if (AdaptiveGrid::enabled() && (streamMode || pipelineMode || Dither::mode != DITHER_NONE || TileAssigner::enabled() || regionMode || outputFormat == "dzi")) {
+        cout << "error: \"--adaptive\" can't be used with \"--stream\", \"--pipeline\", \"--dither\", the repetition limits, \"--region\" or the \"dzi\" output format!\n";
+        return 0;
+    }
+
+    // The pipeline composes rows in order into a plain image file while they're being matched
+    if (pipelineMode && (streamMode || Dither::mode != DITHER_NONE || TileAssigner::enabled() || regionMode || outputFormat == "dzi" || Mosaic::mapOutputFile)) {
+        cout << "error: \"--pipeline\" can't be used with \"--stream\", \"--dither\", the repetition limits, \"--region\", \"--mmap\" or the \"dzi\" output format!\n";
+        return 0;
+    }
+
     cout << "Loading tile pallet from \"" << palletFilePath << "\"..." << "\n";
     Pallet pallet = Pallet();
     Pallet *pallet_ptr = &pallet;
@@ -102,34 +612,154 @@ int main(int argc, char *argv[]) {
     loadedTiles_String += "----------------------------------------------------\n\n";
     cout << loadedTiles_String;
     cout << "Loaded tiles: " << pallet.tiles.size() << "\n" << "\n"; 
+    if (pallet.variantTiles.size() > 0) cout << "Tile variants: " << pallet.variantTiles.size() << "\n" << "\n";
+
+    TileMatcher::palletClusters = pallet.clusters;
+    if (pallet.clusters.size() > 0) cout << "Pallet clusters: " << pallet.clusters.size() << "\n" << "\n";
+
+    if (palletShardCount > 0) {
+        // Worker process started by a pallet sharding coordinator
+        cout << "Matching against pallet shard " << palletShardIndex << " of " << palletShardCount << "..." << "\n";
+        return ShardedRender::matchPalletShard(inputImagePath, pallet, gridWidth, gridHeight, palletShardIndex, palletShardCount, threadCount, silentMode);
+    }
+
+    if (shardCount > 0) {
+        // Worker process started by a coordinator
+        cout << "Rendering shard " << shardIndex << " of " << shardCount << "..." << "\n";
+        return ShardedRender::renderShard(inputImagePath, pallet, gridWidth, gridHeight, shardIndex, shardCount, threadCount, silentMode);
+    }
+
+    if (frameMode) {
+        cout << "Matching and generating mosaic frames..." << "\n";
+        uint64_t startTime = timeSinceEpochMillisec();
+        if (FrameSequence::run(inputImagePath, pallet, gridWidth, gridHeight, threadCount, silentMode)) return 1;
+        uint64_t endTime = timeSinceEpochMillisec();
+
+        cout << "\n" << "Done!" << "\n";
+        cout << "\n" << "Total time elapsed: " << (double)(endTime - startTime) / (double)1000 << " s" << "\n";
+        return 0;
+    }
+
+    vector<Tile> tiles;
+    uint64_t matchStartTime;
+    uint64_t matchEndTime;
+    if (workerCount > 0) {
+        // The workers split the threads, every one of them runs the same command with its own shard
+        cout << "Rendering mosaic with " << workerCount << " worker processes..." << "\n";
+        workerArgs.insert(workerArgs.begin(), argv[0]);
+        workerArgs.push_back("--threads");
+        workerArgs.push_back(to_string(max(1u, threadCount / workerCount)));
+        Mosaic::setImageName(inputImagePath);
+        matchStartTime = timeSinceEpochMillisec();
+        if (ShardedRender::coordinate(workerArgs, pallet, workerCount, threadCount, tiles)) {
+            cout << "error: Unable to write image file" << "\n";
+            return 1;
+        }
+        matchEndTime = timeSinceEpochMillisec();
+        if (gridWidth > 0) cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << tiles.size() << "px)" << "\n" << "\n";
+    }
+    else if (palletWorkerCount > 0) {
+        // Every worker matches the whole grid against its part of the pallet
+        if (palletWorkerCount > pallet.tiles.size()) {
+            cout << "error: There can't be more pallet workers than pallet tiles!\n";
+            return 1;
+        }
 
-    cout << "Creating image CIELAB color array ..." << "\n";
-    vector<CIELABColor> pixels_CIELAB = Mosaic::fetchImagePixelCIELABColors(inputImagePath);
-    if (pixels_CIELAB.size() < 1) return 1;
-    cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << pixels_CIELAB.size() << "px)" << "\n" << "\n";
+        cout << "Calculating closest pixel/tile color matches with " << palletWorkerCount << " pallet worker processes..." << "\n";
+        workerArgs.insert(workerArgs.begin(), argv[0]);
+        workerArgs.push_back("--threads");
+        workerArgs.push_back(to_string(max(1u, threadCount / palletWorkerCount)));
+        Mosaic::setImageName(inputImagePath);
+        matchStartTime = timeSinceEpochMillisec();
+        tiles = ShardedRender::matchPalletSharded(workerArgs, pallet, palletWorkerCount);
+        matchEndTime = timeSinceEpochMillisec();
+        if (tiles.size() < 1) return 1;
+        if (gridWidth > 0) cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << tiles.size() << "px)" << "\n" << "\n";
+    }
+    else if (previousImagePath != "") {
+        // Only the cells that changed since the previous run are matched and composed
+        cout << "Updating mosaic of \"" << previousImagePath << "\"..." << "\n";
+        matchStartTime = timeSinceEpochMillisec();
+        if (IncrementalRender::run(inputImagePath, previousImagePath, previousManifestPath, pallet, palletFilePath, gridWidth, gridHeight, threadCount, silentMode, tiles)) {
+            cout << "error: Unable to write image file" << "\n";
+            return 1;
+        }
+        matchEndTime = timeSinceEpochMillisec();
+        if (gridWidth > 0) cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << tiles.size() << "px)" << "\n" << "\n";
+    }
+    else if (pipelineMode) {
+        // Matching, composition and encoding all run at once, so it's all timed as matching
+        cout << "Matching tiles and generating mosaic image file in a pipeline..." << "\n";
+        matchStartTime = timeSinceEpochMillisec();
+        if (MosaicPipeline::run(inputImagePath, pallet, gridWidth, gridHeight, threadCount, silentMode, tiles)) {
+            cout << "error: Unable to write image file" << "\n";
+            return 1;
+        }
+        matchEndTime = timeSinceEpochMillisec();
+        if (gridWidth > 0) cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << tiles.size() << "px)" << "\n" << "\n";
+    }
+    else if (streamMode) {
+        // The image is decoded, converted and matched one band at a time
+        cout << "Streaming image bands and calculating closest pixel/tile color matches..." << "\n";
+        matchStartTime = timeSinceEpochMillisec();
+        tiles = Mosaic::matchImageStreaming(inputImagePath, pallet.tiles, gridWidth, gridHeight, bandHeight, silentMode);
+        matchEndTime = timeSinceEpochMillisec();
+        if (tiles.size() < 1) return 1;
+        cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << tiles.size() << "px)" << "\n" << "\n";
+    }
+    else if (Dither::mode == DITHER_NONE && !TileAssigner::enabled() && !AdaptiveGrid::enabled()) {
+        // Decoding, conversion and matching are fused per grid row on every thread
+        cout << "Decoding image and calculating closest pixel/tile color matches..." << "\n";
+        matchStartTime = timeSinceEpochMillisec();
+        tiles = Mosaic::matchImageFused(inputImagePath, pallet.tiles, gridWidth, gridHeight, threadCount, silentMode);
+        matchEndTime = timeSinceEpochMillisec();
+        if (tiles.size() < 1) return 1;
+        if (gridWidth > 0) cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << tiles.size() << "px)" << "\n" << "\n";
+    }
+    else {
+        // Dithering, the repetition limits and adaptive tiles need every cell's color at once
+        cout << "Creating image CIELAB color array ..." << "\n";
+        LabPlanes pixels_CIELAB = Mosaic::fetchImagePixelCIELABColors(inputImagePath, gridWidth, gridHeight);
+        if (pixels_CIELAB.size() < 1) return 1;
+        if (gridWidth > 0) cout << "Source resolution: " << Mosaic::sourceImageWidth << "x" << Mosaic::sourceImageHeight << "\n";
+        cout << "Image resolution: " << Mosaic::imageWidth << "x" << Mosaic::imageHeight << " (" << pixels_CIELAB.size() << "px)" << "\n" << "\n";
 
-    cout << "Calculating closest pixel/tile color matches..." << "\n";
-    uint64_t matchStartTime = timeSinceEpochMillisec();
-    vector<Tile> tiles = Mosaic::matchPixelsAndPalletTiles(pixels_CIELAB, pallet.tiles, silentMode);
-    uint64_t matchEndTime = timeSinceEpochMillisec();
+        cout << "Calculating closest pixel/tile color matches..." << "\n";
+        matchStartTime = timeSinceEpochMillisec();
+        if (Dither::mode != DITHER_NONE) tiles = Dither::match(pixels_CIELAB, pallet.tiles, Mosaic::imageWidth, Mosaic::imageHeight, threadCount, silentMode);
+        else if (AdaptiveGrid::enabled()) tiles = AdaptiveGrid::match(pixels_CIELAB, pallet.tiles, Mosaic::imageWidth, Mosaic::imageHeight, threadCount, silentMode);
+        else tiles = TileAssigner::assign(pixels_CIELAB, pallet.tiles, Mosaic::imageWidth, Mosaic::imageHeight, threadCount, silentMode);
+        matchEndTime = timeSinceEpochMillisec();
+    }
 
     if (debug) for(int i = 0; i < tiles.size(); i++){
         cout << tiles[i].pixelId << "\t" << tiles[i].palletId << "\t" << tiles[i].closestDeltaE << "\n";
     }
 
-    cout << "Generating mosaic image file..." << "\n";
     uint64_t generationStartTime = timeSinceEpochMillisec();
-    try{
-        bool result = Mosaic::generateMosaicImageFile(tiles, pallet, silentMode);
+    if (!pipelineMode && previousImagePath == "" && workerCount < 1) {
+        cout << "Generating mosaic image file..." << "\n";
+        try{
+            bool result;
+            if (regionMode) result = Mosaic::generateMosaicRegionFile(tiles, pallet, regionX, regionY, regionWidth, regionHeight, regionScale, threadCount);
+            else if (outputFormat == "dzi") result = Mosaic::generateMosaicDeepZoom(tiles, pallet, pyramidTileSize, threadCount, silentMode);
+            else result = Mosaic::generateMosaicImageFile(tiles, pallet, silentMode, threadCount);
         
-        // If functions return "true" throw error
-        if (result) {
+            // If functions return "true" throw error
+            if (result) {
+                cout << "error: Unable to write image file" << "\n";
+                return 1;
+            }
+        } catch(const exception&) {
             cout << "error: Unable to write image file" << "\n";
             return 1;
         }
-    } catch (exception) {
-        cout << "error: Unable to write image file" << "\n";
-        return 1;
     }
     uint64_t generationEndTime = timeSinceEpochMillisec();
 
@@ -144,8 +774,8 @@ int main(int argc, char *argv[]) {
     
     cout << "\n" << "Done!" << "\n";
 
-    cout << "\n" << "Pixels processed: " << pixels_CIELAB.size()
-        << "\n" << "Match calculations: " << pixels_CIELAB.size() * pallet.tiles.size()
+    cout << "\n" << "Pixels processed: " << tiles.size()
+        << "\n" << "Match calculations: " << tiles.size() * pallet.tiles.size()
         << "\n" << "Match calculation time: " 
         << (double)(matchEndTime - matchStartTime) / (double)1000 << " s" << "\n"
         << "\n" << "Mosaic generation time: " 
@@ -154,6 +784,8 @@ int main(int argc, char *argv[]) {
         << (double)((matchEndTime - matchStartTime) + (generationEndTime - generationStartTime)) / (double)1000 
         << " s"  << "\n" << "\n";
 
+    if (TileCache::cacheDirPath != "") cout << "Tile cache: " << TileCache::hits << " hits, " << TileCache::misses << " misses" << "\n" << "\n";
+
     // Pause before exiting
     uint64_t execFinishTime = timeSinceEpochMillisec();
     while(timeSinceEpochMillisec() < execFinishTime + 1500);
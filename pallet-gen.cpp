@@ -3,6 +3,7 @@
 #include <vector>
 #include <filesystem> 
 #include <fstream> 
+#include <algorithm>
 #include "lib/colors.h"
 #include "lib/mosaic.h"
 
@@ -25,8 +26,32 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
+	// Options after the directory path:
+	// "--clusters <count>" clusters the tiles by color so matching can skip whole clusters,
+	// "--dedupe <deltaE>" drops tiles within "deltaE" of an earlier tile, 
+	// "--keep-variants" keeps those as variants of the earlier tile instead
+	unsigned int clusterCount = 0;
+	double dedupeDeltaE = -1;
+	bool keepVariants = false;
+	bool validOptions = true;
+	for (int i = 2; i < argc && validOptions; i++){
+		string arg = argv[i];
+		try{
+			if (arg == "--clusters" && i + 1 < argc) clusterCount = stoul(argv[++i]);
+			else if (arg == "--dedupe" && i + 1 < argc) dedupeDeltaE = stod(argv[++i]);
+			else if (arg == "--keep-variants") keepVariants = true;
+			else validOptions = false;
+		} catch(const exception&){
+			validOptions = false;
+		}
+	}
+	if (!validOptions || (keepVariants && dedupeDeltaE < 0)){
+		std::cout << "Error: Options must be \"--clusters <count>\", \"--dedupe <deltaE>\" or \"--keep-variants\" with \"--dedupe\"" << "\n";
+		return 1;
+	}
+
 	path p = argv[1];
-	if (argc == 2 && is_directory(p)){ 
+	if (is_directory(p)){ 
 		string path_string = p.string();
 
 		for(int i = 0; i < path_string.size(); i++){
@@ -56,7 +81,7 @@ int main(int argc, char *argv[]) {
 	int global_i = 0;
 	unsigned int minResolution = 2'147'483'647;
 	unsigned int *minResolution_ptr = &minResolution;
-	string tilesJSONString = "\"tiles\": [";
+	vector<palletTile> palletTiles;
 	do{
 		string filePath_String = filePath_List[global_i];
 
@@ -84,15 +109,12 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
-		tilesJSONString += "{\"name\": \"" + name + "\", "
-			+ "\"fileType\": \"" + fileType +
-			+ "\", \"CIELABColor\": {"
-			+ "\"L\": " + to_string(avrgCIELABColor.L) + ", " 
-			+ "\"a\": " + to_string(avrgCIELABColor.a) + ", " 
-			+ "\"b\": " + to_string(avrgCIELABColor.b) + "" 
-			+ "}}";
-
-		if (global_i + 1 < filePath_List.size()) tilesJSONString += ", ";
+		// Deduped and clustered with the colors as they're written to the file
+		palletTile tile;
+		tile.name = name;
+		tile.fileType = fileType;
+		tile.labColor = CIELABColor(stod(to_string(avrgCIELABColor.L)), stod(to_string(avrgCIELABColor.a)), stod(to_string(avrgCIELABColor.b)));
+		palletTiles.push_back(tile);
 
 		std::cout << "Added \"" << name << "\" with " << "lab(" 
 			<< avrgCIELABColor.toString() << ")" << "\n";
@@ -100,7 +122,116 @@ int main(int argc, char *argv[]) {
 		global_i++;
 	} while (global_i < filePath_List.size());
 
-	jsonText += "\"minWidthHeight\": " + to_string(minResolution) + ", " + tilesJSONString + "]}";
+	// Every tile within "dedupeDeltaE" of an earlier kept tile becomes its duplicate. 
+	// Kept tiles are bucketed into a grid of cells at least "dedupeDeltaE" wide, so 
+	// only the 27 cells around a tile can hold one close enough
+	double gridMin[3] = {0, 0, 0};
+	double gridMax[3] = {0, 0, 0};
+	for(uint64_t i = 0; i < palletTiles.size(); i++){
+		const double coordinates[3] = {palletTiles[i].labColor.L, palletTiles[i].labColor.a, palletTiles[i].labColor.b};
+		for(int k = 0; k < 3; k++){
+			gridMin[k] = (i == 0) ? coordinates[k] : min(gridMin[k], coordinates[k]);
+			gridMax[k] = (i == 0) ? coordinates[k] : max(gridMax[k], coordinates[k]);
+		}
+	}
+	const double extent = max(max(gridMax[0] - gridMin[0], gridMax[1] - gridMin[1]), gridMax[2] - gridMin[2]);
+	const double cellSize = max(max(dedupeDeltaE, extent / 64), 1e-6);
+	int gridSize[3];
+	for(int k = 0; k < 3; k++) gridSize[k] = (int)((gridMax[k] - gridMin[k]) / cellSize) + 1;
+	vector<vector<uint64_t>> cellKeptIds;
+	if (dedupeDeltaE >= 0) cellKeptIds.resize((uint64_t)gridSize[0] * gridSize[1] * gridSize[2]);
+
+	vector<palletTile> keptTiles;
+	vector<vector<palletTile>> duplicateTiles;
+	for(uint64_t i = 0; i < palletTiles.size(); i++){
+		if (dedupeDeltaE < 0) {
+			keptTiles.push_back(palletTiles[i]);
+			duplicateTiles.push_back(vector<palletTile>());
+			continue;
+		}
+
+		const double coordinates[3] = {palletTiles[i].labColor.L, palletTiles[i].labColor.a, palletTiles[i].labColor.b};
+		int cell[3];
+		for(int k = 0; k < 3; k++) cell[k] = min(gridSize[k] - 1, (int)((coordinates[k] - gridMin[k]) / cellSize));
+
+		// The earliest kept tile in range wins, just like scanning the kept tiles in order
+		uint64_t keptId = keptTiles.size();
+		for(int cL = max(cell[0] - 1, 0); cL <= min(cell[0] + 1, gridSize[0] - 1); cL++){
+			for(int cA = max(cell[1] - 1, 0); cA <= min(cell[1] + 1, gridSize[1] - 1); cA++){
+				for(int cB = max(cell[2] - 1, 0); cB <= min(cell[2] + 1, gridSize[2] - 1); cB++){
+					for(uint64_t k : cellKeptIds[((uint64_t)cL * gridSize[1] + cA) * gridSize[2] + cB]){
+						if (k >= keptId) break;
+						if (Colors::calcDeltaE(palletTiles[i].labColor, keptTiles[k].labColor) <= dedupeDeltaE) keptId = k;
+					}
+				}
+			}
+		}
+
+		if (keptId < keptTiles.size()) duplicateTiles[keptId].push_back(palletTiles[i]);
+		else {
+			cellKeptIds[((uint64_t)cell[0] * gridSize[1] + cell[1]) * gridSize[2] + cell[2]].push_back(keptTiles.size());
+			keptTiles.push_back(palletTiles[i]);
+			duplicateTiles.push_back(vector<palletTile>());
+		}
+	}
+	if (dedupeDeltaE >= 0) {
+		std::cout << (keepVariants ? "Kept " : "Dropped ") << palletTiles.size() - keptTiles.size() << " near-duplicate tiles" 
+			<< (keepVariants ? " as variants" : "") << ", " << keptTiles.size() << " tiles left to match against" << "\n";
+	}
+
+	string tilesJSONString = "\"tiles\": [";
+	for(uint64_t i = 0; i < keptTiles.size(); i++){
+		tilesJSONString += "{\"name\": \"" + keptTiles[i].name + "\", "
+			+ "\"fileType\": \"" + keptTiles[i].fileType +
+			+ "\", \"CIELABColor\": {"
+			+ "\"L\": " + to_string(keptTiles[i].labColor.L) + ", " 
+			+ "\"a\": " + to_string(keptTiles[i].labColor.a) + ", " 
+			+ "\"b\": " + to_string(keptTiles[i].labColor.b) + "" 
+			+ "}";
+
+		if (keepVariants && duplicateTiles[i].size() > 0){
+			tilesJSONString += ", \"variants\": [";
+			for(uint64_t v = 0; v < duplicateTiles[i].size(); v++){
+				tilesJSONString += "{\"name\": \"" + duplicateTiles[i][v].name + "\", "
+					+ "\"fileType\": \"" + duplicateTiles[i][v].fileType +
+					+ "\", \"CIELABColor\": {"
+					+ "\"L\": " + to_string(duplicateTiles[i][v].labColor.L) + ", " 
+					+ "\"a\": " + to_string(duplicateTiles[i][v].labColor.a) + ", " 
+					+ "\"b\": " + to_string(duplicateTiles[i][v].labColor.b) + "" 
+					+ "}}";
+				if (v + 1 < duplicateTiles[i].size()) tilesJSONString += ", ";
+			}
+			tilesJSONString += "]";
+		}
+		tilesJSONString += "}";
+
+		if (i + 1 < keptTiles.size()) tilesJSONString += ", ";
+	}
+
+	jsonText += "\"minWidthHeight\": " + to_string(minResolution) + ", " + tilesJSONString + "]";
+
+	if (clusterCount > 0){
+		vector<palletCluster> clusters = Pallet::clusterTiles(keptTiles, clusterCount);
+
+		jsonText += ", \"clusters\": [";
+		for(uint64_t c = 0; c < clusters.size(); c++){
+			jsonText += "{\"L\": " + to_string(clusters[c].centroid.L) + ", "
+				+ "\"a\": " + to_string(clusters[c].centroid.a) + ", "
+				+ "\"b\": " + to_string(clusters[c].centroid.b) + ", "
+				+ "\"radius\": " + to_string(clusters[c].radius) + ", "
+				+ "\"tiles\": [";
+			for(uint64_t i = 0; i < clusters[c].palletIds.size(); i++){
+				jsonText += to_string(clusters[c].palletIds[i]);
+				if (i + 1 < clusters[c].palletIds.size()) jsonText += ", ";
+			}
+			jsonText += "]}";
+			if (c + 1 < clusters.size()) jsonText += ", ";
+		}
+		jsonText += "]";
+
+		std::cout << "Clustered tiles into " << clusters.size() << " clusters" << "\n";
+	}
+	jsonText += "}";
 
 	// Write to tiles pallet JSON file
 	ofstream tilesPallet_stream("pallet.json");